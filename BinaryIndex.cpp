@@ -0,0 +1,102 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "BinaryIndex.h"
+#include "SimilarityKernels.h"
+
+#include <algorithm>
+
+void BinaryIndex::reset(int dimension)
+{
+	clear();
+	m_dimension = dimension;
+	m_words = (dimension + 63) / 64;
+}
+
+void BinaryIndex::clear()
+{
+	m_codes.clear();
+	m_labels.clear();
+	m_rowOfLabel.clear();
+}
+
+void BinaryIndex::add(int label, const float *vector)
+{
+	remove(label);
+
+	const std::size_t offset = m_codes.size();
+	m_codes.resize(offset + m_words);
+	encode(vector, m_codes.data() + offset);
+	m_rowOfLabel.insert(label, qsizetype(m_labels.size()));
+	m_labels.push_back(label);
+}
+
+bool BinaryIndex::remove(int label)
+{
+	auto it = m_rowOfLabel.find(label);
+	if (it == m_rowOfLabel.end())
+		return false;
+
+	// move the last code into the freed slot
+	const qsizetype row = it.value();
+	const qsizetype last = qsizetype(m_labels.size()) - 1;
+	m_rowOfLabel.erase(it);
+	if (row != last) {
+		std::copy_n(m_codes.data() + last * m_words, m_words, m_codes.data() + row * m_words);
+		m_labels[row] = m_labels[last];
+		m_rowOfLabel[m_labels[row]] = row;
+	}
+	m_labels.pop_back();
+	m_codes.resize(last * m_words);
+	return true;
+}
+
+QVector<ScoredId> BinaryIndex::search(const float *query, int candidates) const
+{
+	std::vector<std::uint64_t> code(m_words);
+	encode(query, code.data());
+
+	constexpr qsizetype blockSize = 1024;
+	std::uint32_t distances[blockSize];
+
+	TopK best(candidates);
+	for (qsizetype begin = 0; begin < size(); begin += blockSize) {
+		const qsizetype count = qMin(blockSize, size() - begin);
+		Similarity::hammingBatch(code.data(), m_codes.data() + begin * m_words, m_words, count, distances);
+		for (qsizetype i = 0; i < count; ++i) {
+			const float score = -float(distances[i]);
+			if (best.accepts(score))
+				best.push(score, m_labels[begin + i]);
+		}
+	}
+	return best.sorted();
+}
+
+void BinaryIndex::encode(const float *vector, std::uint64_t *code) const
+{
+	std::fill_n(code, m_words, 0);
+	for (int i = 0; i < m_dimension; ++i) {
+		if (vector[i] > 0.0f)
+			code[i / 64] |= std::uint64_t(1) << (i % 64);
+	}
+}
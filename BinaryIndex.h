@@ -0,0 +1,66 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BINARYINDEX_H
+#define BINARYINDEX_H
+
+#include <QHash>
+#include <QVector>
+
+#include <cstdint>
+#include <vector>
+
+#include "TopK.h"
+
+// One bit per dimension (the sign) copy of every embedding, 96 bytes for a
+// 768-d vector. search() ranks the whole corpus by Hamming distance to the
+// query code and is meant as a cheap prefilter ahead of an exact rerank.
+class BinaryIndex
+{
+public:
+	BinaryIndex() = default;
+
+	void reset(int dimension);
+	void clear();
+
+	inline int dimension() const { return m_dimension; }
+	inline int words() const { return m_words; }
+	inline qsizetype size() const { return qsizetype(m_labels.size()); }
+
+	void add(int label, const float *vector);
+	bool remove(int label);
+
+	// Best `candidates` labels, scored by negative Hamming distance
+	QVector<ScoredId> search(const float *query, int candidates) const;
+
+private:
+	void encode(const float *vector, std::uint64_t *code) const;
+
+	int m_dimension = 0;
+	int m_words = 0;
+	std::vector<std::uint64_t> m_codes;
+	std::vector<int> m_labels;
+	QHash<int, qsizetype> m_rowOfLabel;
+};
+
+#endif // BINARYINDEX_H
@@ -0,0 +1,148 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ContextPacker.h"
+#include "SimilarityKernels.h"
+#include "TextChunker.h"
+
+#include <algorithm>
+#include <limits>
+
+// Chunk ids are file:page:chunk
+static QString pageOf(const QString &id, int &chunk)
+{
+	const qsizetype colon = id.lastIndexOf(':');
+	bool ok = false;
+	chunk = colon >= 0 ? id.mid(colon + 1).toInt(&ok) : 0;
+	if (!ok) {
+		chunk = -2; // never adjacent to anything
+		return id;
+	}
+	return id.left(colon);
+}
+
+ContextPacker::ContextPacker(const Options &options)
+	: m_options(options)
+{
+	m_options.tokenBudget = qMax(1, m_options.tokenBudget);
+	m_options.lambda = qBound(0.0f, m_options.lambda, 1.0f);
+}
+
+QVector<Document> ContextPacker::pack(const QVector<Document> &candidates, const QVector<float> &vectors, int stride) const
+{
+	const qsizetype n = candidates.size();
+	const bool hasVectors = stride > 0 && vectors.size() >= n * stride;
+
+	double best = 0.0;
+	for (const Document &doc : candidates)
+		best = qMax(best, doc.value);
+
+	// Greedy MMR: each step takes the candidate with the best trade-off of
+	// relevance and similarity to what was already picked
+	QVector<float> redundancy(n, 0.0f);
+	QVector<bool> done(n, false);
+	QVector<qsizetype> picked;
+	int tokens = 0;
+	for (;;) {
+		qsizetype next = -1;
+		double nextScore = -std::numeric_limits<double>::infinity();
+		for (qsizetype i = 0; i < n; ++i) {
+			if (done[i])
+				continue;
+			const double relevance = best > 0.0 ? candidates[i].value / best : 0.0;
+			const double score = m_options.lambda * relevance - (1.0 - m_options.lambda) * redundancy[i];
+			if (score > nextScore) {
+				next = i;
+				nextScore = score;
+			}
+		}
+		if (next < 0)
+			break;
+		done[next] = true;
+
+		// a shorter candidate further down may still fit
+		const int cost = TextChunker::estimateTokens(candidates[next].text);
+		if (tokens + cost > m_options.tokenBudget)
+			continue;
+		tokens += cost;
+		picked.append(next);
+
+		if (!hasVectors)
+			continue;
+		const float *row = vectors.constData() + next * stride;
+		for (qsizetype i = 0; i < n; ++i) {
+			if (done[i])
+				continue;
+			const float similarity = Similarity::dot(row, vectors.constData() + i * stride, stride);
+			redundancy[i] = qMax(redundancy[i], similarity);
+			if (similarity >= m_options.duplicateSimilarity)
+				done[i] = true;
+		}
+	}
+
+	// Group the picks by page, pages ordered by their best pick
+	QVector<QVector<qsizetype>> pages;
+	QHash<QString, qsizetype> pageIndex;
+	QVector<int> chunks(n, 0);
+	for (qsizetype i : picked) {
+		const QString page = pageOf(candidates[i].id, chunks[i]);
+		if (!pageIndex.contains(page)) {
+			pageIndex.insert(page, pages.size());
+			pages.append({});
+		}
+		pages[pageIndex.value(page)].append(i);
+	}
+
+	QVector<Document> context;
+	for (QVector<qsizetype> &members : pages) {
+		std::sort(members.begin(), members.end(), [&chunks](qsizetype a, qsizetype b) {
+			return chunks[a] < chunks[b];
+		});
+
+		Document merged = candidates[members.first()];
+		for (qsizetype m = 1; m < members.size(); ++m) {
+			const Document &doc = candidates[members[m]];
+			if (chunks[members[m]] == chunks[members[m - 1]] + 1) {
+				merged.text = mergeOverlapping(merged.text, doc.text);
+				merged.value = qMax(merged.value, doc.value);
+			} else {
+				context.append(merged);
+				merged = doc;
+			}
+		}
+		context.append(merged);
+	}
+	return context;
+}
+
+QString ContextPacker::mergeOverlapping(const QString &first, const QString &second)
+{
+	// The chunker starts each chunk a little before the previous one ended,
+	// the longest end of `first` that starts `second` is that overlap
+	constexpr qsizetype minOverlap = 8;
+	for (qsizetype length = qMin(first.size(), second.size()); length >= minOverlap; --length) {
+		if (first.endsWith(QStringView(second).left(length)))
+			return first + second.mid(length);
+	}
+	return first + ' ' + second;
+}
@@ -0,0 +1,59 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CONTEXTPACKER_H
+#define CONTEXTPACKER_H
+
+#include <QVector>
+
+#include "EmbeddingDatabase.h"
+
+// Turns a ranked candidate list into the context of a prompt. Maximal
+// marginal relevance picks chunks that are relevant and add something new
+// until the token budget is spent; neighbouring chunks of one page are then
+// joined so the text they share is sent once.
+class ContextPacker
+{
+public:
+	struct Options {
+		int tokenBudget = 1536;
+		float lambda = 0.7f; // weight of relevance against novelty
+		float duplicateSimilarity = 0.95f; // candidates this close to a picked chunk are dropped
+	};
+
+	ContextPacker() = default;
+	explicit ContextPacker(const Options &options);
+
+	// `vectors` holds a unit length row of `stride` floats per candidate,
+	// zeros for candidates without one. Relevance is the candidate's score
+	// relative to the best one, so vector and hybrid scores both work.
+	QVector<Document> pack(const QVector<Document> &candidates, const QVector<float> &vectors, int stride) const;
+
+	// Appends `second` to `first` without the text it repeats from the end of `first`
+	static QString mergeOverlapping(const QString &first, const QString &second);
+
+private:
+	Options m_options;
+};
+
+#endif // CONTEXTPACKER_H
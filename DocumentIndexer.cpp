@@ -0,0 +1,241 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "DocumentIndexer.h"
+
+#include <QDebug>
+#include <QTimer>
+
+#include <utility>
+
+DocumentIndexer::DocumentIndexer(EmbeddingDatabase &db, OllamaClient &client, QObject *parent)
+	: QObject(parent)
+	, m_db(db)
+	, m_client(client)
+{
+	connect(&m_client, &OllamaClient::embeddingReady, this, &DocumentIndexer::chunkEmbedded);
+	connect(&m_client, &OllamaClient::embeddingFailed, this, [this](const QString& id) {
+		chunkEmbedded(id, {});
+	});
+
+	connect(&m_pipeline, &IngestionPipeline::documentOpened, this, [this](const QString& filePath, int pageCount) {
+		if (m_ingestingFiles.contains(filePath))
+			m_ingestingFiles[filePath].pages = pageCount;
+	});
+	connect(&m_pipeline, &IngestionPipeline::chunksAvailable, this, &DocumentIndexer::embedQueuedChunks);
+	connect(&m_pipeline, &IngestionPipeline::finished, this, &DocumentIndexer::embedQueuedChunks);
+}
+
+void DocumentIndexer::setChunkOptions(const TextChunker::Options &options)
+{
+	m_pipeline.setChunkOptions(options);
+}
+
+void DocumentIndexer::start(const QDir &directory)
+{
+	m_chunksStored = 0;
+	m_failedFiles.clear();
+	m_running = true;
+	m_pipeline.start(applyManifestDiff(directory));
+}
+
+QVector<IngestionPipeline::SourceFile> DocumentIndexer::applyManifestDiff(const QDir &directory)
+{
+	const QFileInfoList entries = directory.entryInfoList(QDir::Files);
+
+	// Only files directly in the directory are listed, so only their
+	// manifest entries can turn out removed or moved
+	const QString directoryPath = directory.absolutePath();
+	QVector<FileFingerprint> manifest;
+	for (const FileFingerprint &file : m_db.fileManifest()) {
+		if (QFileInfo(file.path).absolutePath() == directoryPath)
+			manifest.append(file);
+	}
+
+	// Databases from before the manifest: adopt the files they already hold
+	QSet<QString> known;
+	for (const FileFingerprint &file : manifest)
+		known.insert(file.path);
+	for (const QFileInfo &entry : entries) {
+		if (!known.contains(entry.absoluteFilePath()) && m_db.hasCollection(entry.absoluteFilePath())) {
+			manifest.append(FileManifest::fingerprint(entry, true));
+			m_db.updateFileManifest(manifest.last());
+		}
+	}
+
+	const FileManifest::Diff diff = FileManifest::diff(manifest, entries);
+	qDebug() << "Data directory:" << diff.unchanged.size() << "unchanged," << diff.added.size() << "new,"
+			 << diff.changed.size() << "changed," << diff.moved.size() << "moved," << diff.removed.size() << "removed";
+
+	// Chunks belong to the collection named by their file's path, chunk ids
+	// start with the file name
+	auto chunkPrefix = [](const QString& path) { return QFileInfo(path).fileName() + ":"; };
+
+	for (const FileFingerprint &file : diff.removed) {
+		m_db.removeCollectionDocuments(file.path);
+		m_db.removeCollection(file.path);
+		m_db.removeFromFileManifest(file.path);
+	}
+	for (const auto &move : diff.moved) {
+		m_db.renameCollection(move.first.path, move.second.path);
+		m_db.renameDocuments(move.second.path, chunkPrefix(move.first.path), chunkPrefix(move.second.path));
+		m_db.removeFromFileManifest(move.first.path);
+		m_db.updateFileManifest(move.second);
+	}
+	for (const FileFingerprint &file : diff.touched)
+		m_db.updateFileManifest(file);
+
+	// Changed files are chunked again, chunks whose text did not change hit
+	// the embedding cache
+	for (const FileFingerprint &file : diff.changed) {
+		m_db.removeCollectionDocuments(file.path);
+		m_db.removeCollection(file.path);
+		m_db.removeFromFileManifest(file.path);
+	}
+
+	for (const FileFingerprint &file : diff.unchanged)
+		emit fileListed(file);
+	for (const FileFingerprint &file : diff.touched)
+		emit fileListed(file);
+	for (const auto &move : diff.moved)
+		emit fileListed(move.second);
+
+	// Files are committed batch by batch and only enter the manifest once
+	// complete, so a new file can have chunks left from an interrupted run
+	int partial = 0;
+	for (const FileFingerprint &file : diff.added)
+		partial += m_db.removeCollectionDocuments(file.path);
+	if (partial > 0)
+		qDebug() << "Removed" << partial << "chunks of interrupted ingestion";
+
+	// Only new and changed files are opened at all
+	QVector<IngestionPipeline::SourceFile> files;
+	for (const QVector<FileFingerprint> *list : { &diff.added, &diff.changed }) {
+		for (const FileFingerprint &file : *list) {
+			emit fileListed(file);
+			m_ingestingFiles.insert(file.path, file);
+			files.append({ file.path, true });
+		}
+	}
+	return files;
+}
+
+void DocumentIndexer::embedQueuedChunks()
+{
+	// Only take what the client can batch and keep in flight, the rest waits
+	// in the pipeline's bounded queue. Cache hits waiting to be stored count
+	// too, storing them calls this again.
+	const int maxPending = 2 * m_client.embeddingBatchSize() * m_client.maxEmbeddingRequests();
+	while (m_embeddingChunks.size() + m_embeddedChunks.size() < maxPending) {
+		auto chunk = m_pipeline.takeChunk();
+		if (!chunk)
+			break;
+
+		++m_remainingChunks[chunk->filePath];
+		if (chunk->last) {
+			m_parsedFiles.insert(chunk->filePath);
+			m_ingestingFiles[chunk->filePath].hash = chunk->fileHash;
+		}
+
+		// identical text (copied files, repeated boilerplate) costs no request
+		if (auto embedding = m_db.cachedEmbedding(m_client.embeddingModel(), chunk->text)) {
+			storeChunk({ *chunk, *embedding, true });
+			continue;
+		}
+
+		m_client.embed(chunk->id, chunk->text);
+		m_embeddingChunks.insert(chunk->id, *chunk);
+	}
+
+	if (m_embeddingChunks.isEmpty() && m_pipeline.isFinished() && !m_pipeline.hasChunks() && m_embeddedChunks.isEmpty())
+		finish();
+}
+
+void DocumentIndexer::chunkEmbedded(const QString &id, const QVector<double> &embedding)
+{
+	auto it = m_embeddingChunks.find(id);
+	if (it == m_embeddingChunks.end())
+		return;
+	const Chunk chunk = it.value();
+	m_embeddingChunks.erase(it);
+
+	storeChunk({ chunk, embedding, false });
+	embedQueuedChunks();
+}
+
+void DocumentIndexer::storeChunk(EmbeddedChunk &&chunk)
+{
+	// results of one batch arrive back to back, they are written together
+	m_embeddedChunks.append(std::move(chunk));
+	if (!m_storeScheduled) {
+		m_storeScheduled = true;
+		QTimer::singleShot(0, this, &DocumentIndexer::storeEmbeddedChunks);
+	}
+}
+
+void DocumentIndexer::storeEmbeddedChunks()
+{
+	m_storeScheduled = false;
+	const QVector<EmbeddedChunk> chunks = std::exchange(m_embeddedChunks, {});
+
+	m_db.beginBatch();
+	for (const EmbeddedChunk &embedded : chunks) {
+		const Chunk &chunk = embedded.chunk;
+		if (embedded.embedding.isEmpty()) {
+			m_failedFiles.insert(chunk.filePath);
+		} else {
+			if (!embedded.cached)
+				m_db.cacheEmbedding(m_client.embeddingModel(), chunk.text, embedded.embedding);
+			m_db.addDocument(chunk.id, chunk.text, embedded.embedding, chunk.filePath);
+		}
+
+		// Results arrive out of order, a file is complete once its last chunk
+		// was taken from the pipeline and nothing of it is left in flight.
+		// Files with failed chunks are not marked, so they are ingested again
+		// next time.
+		if (--m_remainingChunks[chunk.filePath] == 0 && m_parsedFiles.contains(chunk.filePath)) {
+			const FileFingerprint file = m_ingestingFiles.take(chunk.filePath);
+			if (!m_failedFiles.contains(chunk.filePath)) {
+				m_db.addCollection(chunk.filePath);
+				m_db.updateFileManifest(file);
+			}
+			m_remainingChunks.remove(chunk.filePath);
+			m_parsedFiles.remove(chunk.filePath);
+			m_failedFiles.remove(chunk.filePath);
+		}
+	}
+	m_db.commitBatch();
+
+	m_chunksStored += int(chunks.size());
+	emit progress(m_chunksStored, m_pipeline.queuedChunks());
+
+	embedQueuedChunks();
+}
+
+void DocumentIndexer::finish()
+{
+	if (!m_running)
+		return;
+	m_running = false;
+	emit finished();
+}
@@ -0,0 +1,92 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DOCUMENTINDEXER_H
+#define DOCUMENTINDEXER_H
+
+#include <QObject>
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+
+#include "EmbeddingDatabase.h"
+#include "FileManifest.h"
+#include "IngestionPipeline.h"
+#include "OllamaClient.h"
+
+// Keeps the database in step with a set of PDF files: applies the manifest
+// diff, chunks new and changed files on the ingestion pipeline, embeds the
+// chunks in batches and stores them file by file. Used by the window and by
+// the command line tool alike.
+class DocumentIndexer : public QObject
+{
+	Q_OBJECT
+public:
+	DocumentIndexer(EmbeddingDatabase &db, OllamaClient &client, QObject *parent = nullptr);
+
+	void setChunkOptions(const TextChunker::Options &options);
+
+	// Indexes the files of `directory`, files indexed from other directories
+	// are left alone
+	void start(const QDir &directory);
+	inline bool isRunning() const { return m_running; }
+	inline IngestionPipeline &pipeline() { return m_pipeline; }
+
+signals:
+	// every file of the indexed set, emitted by start()
+	void fileListed(const FileFingerprint &file);
+	void progress(int chunksStored, int chunksTotal);
+	void finished();
+
+private slots:
+	void embedQueuedChunks();
+	void chunkEmbedded(const QString &id, const QVector<double> &embedding);
+	void storeEmbeddedChunks();
+
+private:
+	struct EmbeddedChunk {
+		Chunk chunk;
+		QVector<double> embedding; // empty if embedding failed
+		bool cached = false;
+	};
+
+	QVector<IngestionPipeline::SourceFile> applyManifestDiff(const QDir &directory);
+	void storeChunk(EmbeddedChunk &&chunk);
+	void finish();
+
+	EmbeddingDatabase &m_db;
+	OllamaClient &m_client;
+	IngestionPipeline m_pipeline;
+	// chunks handed to the client, by id, and how many per file are left
+	QHash<QString, Chunk> m_embeddingChunks;
+	QHash<QString, int> m_remainingChunks;
+	QSet<QString> m_parsedFiles;
+	QHash<QString, FileFingerprint> m_ingestingFiles;
+	QVector<EmbeddedChunk> m_embeddedChunks;
+	bool m_storeScheduled = false;
+	QSet<QString> m_failedFiles;
+	int m_chunksStored = 0;
+	bool m_running = false;
+};
+
+#endif // DOCUMENTINDEXER_H
@@ -22,14 +22,49 @@
  */
 
 #include "EmbeddingDatabase.h"
+#include "SimilarityKernels.h"
+#include "VectorCodec.h"
+
+#include <QCryptographicHash>
+#include <QRegularExpression>
+#include <QSemaphore>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
 
 EmbeddingDatabase::EmbeddingDatabase(QObject *parent)
+	: EmbeddingDatabase("embeddings.db", SearchMode::Hnsw, parent)
+{
+}
+
+EmbeddingDatabase::EmbeddingDatabase(const QString &fileName, SearchMode mode, QObject *parent)
 	: QObject(parent)
+	, m_searchMode(mode)
 {
-	if (!createConnection()) {
+	// Search workers stay alive between queries, asynchronous queries run
+	// one at a time
+	m_searchPool.setExpiryTimeout(-1);
+	m_queryPool.setMaxThreadCount(1);
+
+	if (!createConnection(fileName)) {
 		return;
 	}
 	createTables();
+	migrateEncodings();
+	loadVectors();
+	if (m_searchMode == SearchMode::Hnsw)
+		syncHnswIndex();
+	else if (m_searchMode == SearchMode::IvfPq)
+		syncIvfPqIndex();
+	else if (m_searchMode == SearchMode::Binary)
+		rebuildBinaryIndex();
+}
+
+EmbeddingDatabase::~EmbeddingDatabase()
+{
+	waitForSearches();
+	saveIndexes();
 }
 
 void EmbeddingDatabase::addCollection(const QString &collection)
@@ -45,6 +80,41 @@ void EmbeddingDatabase::addCollection(const QString &collection)
 	}
 }
 
+void EmbeddingDatabase::removeCollection(const QString &collection)
+{
+	QSqlQuery query;
+	query.prepare("DELETE FROM collections WHERE name = :name");
+	query.bindValue(":name", collection);
+
+	if (!query.exec()) {
+		emit error("Error deleting collection: " + query.lastError().text());
+	}
+}
+
+void EmbeddingDatabase::renameCollection(const QString &collection, const QString &name)
+{
+	waitForSearches();
+	QSqlQuery query;
+	query.prepare("UPDATE collections SET name = :name, topic = :name WHERE name = :collection");
+	query.bindValue(":name", name);
+	query.bindValue(":collection", collection);
+
+	if (!query.exec()) {
+		emit error("Error renaming collection: " + query.lastError().text());
+	}
+
+	// the chunks stay tied to the renamed collection
+	query.prepare("UPDATE embeddings_queue SET collection = :name WHERE collection = :collection");
+	query.bindValue(":name", name);
+	query.bindValue(":collection", collection);
+	if (!query.exec()) {
+		emit error("Error renaming collection: " + query.lastError().text());
+		return;
+	}
+	if (m_partitions.contains(collection))
+		m_partitions.insert(name, m_partitions.take(collection));
+}
+
 bool EmbeddingDatabase::hasCollection(const QString &collection)
 {
 	QSqlQuery query;
@@ -91,96 +161,503 @@ QString EmbeddingDatabase::collectionByIndex(int index)
 	return query.next() ? query.value("name").toString() : "";
 }
 
-void EmbeddingDatabase::addDocument(const QString &id, const QString &topic, const QVector<double> &embedding)
+void EmbeddingDatabase::addDocument(const QString &id, const QString &topic, const QVector<double> &embedding, const QString &collection)
 {
-	QByteArray embeddingsData(reinterpret_cast<const char*>(embedding.data()), embedding.size() * sizeof(double));
+	waitForSearches();
+	const QByteArray embeddingsData = VectorCodec::encode(embedding, m_encoding);
 
-	// check if embedding already exists in the database
-	QSqlQuery checkQuery;
-	checkQuery.prepare("SELECT id FROM embeddings_queue WHERE id = :id OR vector = :vector");
+	// check if the document already exists in the database (uses the id
+	// index), files of the same name in other directories have the same ids
+	QSqlQuery &checkQuery = statement("SELECT 1 FROM embeddings_queue WHERE id = :id AND collection IS :collection LIMIT 1");
 	checkQuery.bindValue(":id", id);
-	checkQuery.bindValue(":vector", embeddingsData);
-	if (checkQuery.exec() && checkQuery.next()) {
+	checkQuery.bindValue(":collection", collection.isEmpty() ? QVariant() : QVariant(collection));
+	const bool exists = checkQuery.exec() && checkQuery.next();
+	checkQuery.finish();
+	if (exists) {
 		qDebug() << "Document already exists in the database";
 		return;
 	}
 
-	QSqlQuery query;
-	query.prepare("INSERT INTO embeddings_queue (operation, topic, id, vector) VALUES (:operation, :topic, :id, :vector)");
+	QSqlQuery &query = statement("INSERT INTO embeddings_queue (operation, topic, id, vector, encoding, collection) "
+								 "VALUES (:operation, :topic, :id, :vector, :encoding, :collection)");
 	query.bindValue(":operation", 1);
 	query.bindValue(":topic", topic);
 	query.bindValue(":id", id);
 	query.bindValue(":vector", embeddingsData);
+	query.bindValue(":encoding", VectorCodec::name(m_encoding));
+	query.bindValue(":collection", collection.isEmpty() ? QVariant() : QVariant(collection));
 
 	if (!query.exec()) {
 		emit error("Error inserting document: " + query.lastError().text());
+		return;
+	}
+
+	if (embedding.isEmpty())
+		return;
+	if (m_store.dimension() == 0)
+		m_store.reset(embedding.size(), m_encoding);
+	if (embedding.size() != m_store.dimension()) {
+		qWarning() << "Embedding dimension mismatch for document" << id << embedding.size() << "!=" << m_store.dimension();
+		return;
+	}
+
+	const int seqId = query.lastInsertId().toInt();
+	QVector<float> vector(m_store.stride(), 0.0f);
+	std::copy(embedding.begin(), embedding.end(), vector.begin());
+	m_store.append(seqId, id, vector.constData());
+	if (!collection.isEmpty())
+		m_partitions[collection].append(seqId);
+
+	// the graph scores the stored row, the other indexes encode the
+	// normalized vector
+	Similarity::normalize(vector.data(), m_store.dimension());
+	if (m_hnswReady) {
+		if (m_hnsw.dimension() != m_store.dimension())
+			m_hnsw.reset(&m_store, m_hnswParameters);
+		m_hnsw.insert(seqId, vector.constData());
+		m_hnswDirty = true;
+	}
+	if (m_ivfpqReady) {
+		m_ivfpq.add(seqId, vector.constData());
+		m_ivfpqDirty = true;
 	}
+	if (m_binaryReady) {
+		if (m_binary.dimension() != m_store.dimension())
+			m_binary.reset(m_store.dimension());
+		m_binary.add(seqId, vector.constData());
+	}
+	// after the indexes, which leave their mapped files first
+	markVectorsDirty();
 }
 
 bool EmbeddingDatabase::removeDocument(const QString &id)
 {
+	return removeRows("id = :id", id) >= 0;
+}
+
+int EmbeddingDatabase::removeCollectionDocuments(const QString &collection)
+{
+	return qMax(0, removeRows("collection = :id", collection));
+}
+
+bool EmbeddingDatabase::renameDocuments(const QString &collection, const QString &oldPrefix, const QString &newPrefix)
+{
+	waitForSearches();
+	QSqlQuery query;
+	query.prepare("UPDATE embeddings_queue SET id = :new || substr(id, length(:old) + 1) "
+				  "WHERE collection = :collection AND instr(id, :prefix) = 1");
+	query.bindValue(":new", newPrefix);
+	query.bindValue(":old", oldPrefix);
+	query.bindValue(":collection", collection);
+	query.bindValue(":prefix", oldPrefix);
+	if (!query.exec()) {
+		emit error("Error renaming documents: " + query.lastError().text());
+		return false;
+	}
+
+	// vectors and indexes are keyed by seq_id, only the resident ids change
+	for (int seqId : m_partitions.value(collection)) {
+		const qsizetype row = m_store.rowOf(seqId);
+		if (row >= 0 && m_store.id(row).startsWith(oldPrefix))
+			m_store.setId(row, newPrefix + m_store.id(row).mid(oldPrefix.size()));
+	}
+	return true;
+}
+
+int EmbeddingDatabase::removeRows(const QString &condition, const QString &id)
+{
+	waitForSearches();
+	QSqlQuery selectQuery;
+	selectQuery.prepare("SELECT seq_id, collection FROM embeddings_queue WHERE " + condition);
+	selectQuery.bindValue(":id", id);
+	if (!selectQuery.exec()) {
+		emit error("Error selecting document: " + selectQuery.lastError().text());
+		return -1;
+	}
+	QVector<int> seqIds;
+	QHash<QString, QSet<int>> removedByCollection;
+	while (selectQuery.next()) {
+		seqIds.append(selectQuery.value("seq_id").toInt());
+		removedByCollection[selectQuery.value("collection").toString()].insert(seqIds.last());
+	}
+
 	QSqlQuery deleteQuery;
-	deleteQuery.prepare("DELETE FROM embeddings_queue WHERE id = :id");
+	deleteQuery.prepare("DELETE FROM embeddings_queue WHERE " + condition);
 	deleteQuery.bindValue(":id", id);
 	if (!deleteQuery.exec()) {
 		emit error("Error deleting document: " + deleteQuery.lastError().text());
+		return -1;
+	}
+
+	bool removed = false;
+	for (int seqId : seqIds) {
+		if (m_store.remove(seqId))
+			removed = true;
+		if (m_hnswReady && m_hnsw.markDeleted(seqId))
+			m_hnswDirty = true;
+		if (m_ivfpqReady && m_ivfpq.remove(seqId))
+			m_ivfpqDirty = true;
+		if (m_binaryReady)
+			m_binary.remove(seqId);
+	}
+	if (m_hnswReady && m_hnsw.deletedCount() > m_hnsw.size() * MaxHnswTombstones)
+		rebuildHnswIndex();
+	if (removed)
+		markVectorsDirty();
+	for (auto it = removedByCollection.constBegin(); it != removedByCollection.constEnd(); ++it) {
+		auto partition = m_partitions.find(it.key());
+		if (partition == m_partitions.end())
+			continue;
+		const QSet<int> &removed = it.value();
+		partition->erase(std::remove_if(partition->begin(), partition->end(), [&removed](int seqId) {
+			return removed.contains(seqId);
+		}), partition->end());
+		if (partition->isEmpty())
+			m_partitions.erase(partition);
+	}
+	return int(seqIds.size());
+}
+
+QVector<Document> EmbeddingDatabase::findDocuments(const QVector<double> &targetEmbedding, int topk, const QStringList &collections)
+{
+	QVector<float> target;
+	if (topk <= 0 || !queryVector(targetEmbedding, target) || target.isEmpty())
+		return {};
+	return fetchDocuments(search(target.constData(), topk, collections));
+}
+
+QVector<Document> EmbeddingDatabase::findDocumentsHybrid(const QVector<double> &targetEmbedding, const QString &text, int topk, const QStringList &collections)
+{
+	QVector<float> target;
+	if (topk <= 0 || !queryVector(targetEmbedding, target))
+		return {};
+	return fetchDocuments(fuseRanks(target, searchLexical(text, m_hybridDepth, collections), topk, collections));
+}
+
+void EmbeddingDatabase::findDocumentsAsync(const QVector<double> &targetEmbedding, const QString &text, int topk, const QStringList &collections,
+										   std::function<void(const QVector<Document>&)> callback)
+{
+	QVector<float> target;
+	if (topk <= 0 || !queryVector(targetEmbedding, target)) {
+		callback({});
+		return;
+	}
+
+	// SQL stays on this thread, the vector stage runs on the query thread
+	// and the documents are fetched once its hits are back
+	const bool hybrid = !text.isEmpty();
+	const QVector<int> lexical = hybrid ? searchLexical(text, m_hybridDepth, collections) : QVector<int>();
+	m_queryPool.start([this, target, lexical, hybrid, topk, collections, callback]() {
+		QVector<ScoredId> hits;
+		if (hybrid)
+			hits = fuseRanks(target, lexical, topk, collections);
+		else if (!target.isEmpty())
+			hits = search(target.constData(), topk, collections);
+		QMetaObject::invokeMethod(this, [this, hits, callback]() {
+			callback(fetchDocuments(hits));
+		}, Qt::QueuedConnection);
+	});
+}
+
+bool EmbeddingDatabase::queryVector(const QVector<double> &embedding, QVector<float> &target)
+{
+	target.clear();
+	if (m_store.isEmpty())
+		return true;
+
+	if (embedding.size() != m_store.dimension()) {
+		emit error(QString("Query embedding has %1 dimensions, database has %2").arg(embedding.size()).arg(m_store.dimension()));
 		return false;
 	}
+
+	// Stored rows are unit length, so cosine similarity is the dot product with
+	// the normalized query (zero padded to the row stride for the batch kernel)
+	target.resize(m_store.stride());
+	target.fill(0.0f);
+	std::copy(embedding.begin(), embedding.end(), target.begin());
+	Similarity::normalize(target.data(), m_store.dimension());
 	return true;
 }
 
-QVector<Document> EmbeddingDatabase::findDocuments(const QVector<double> &targetEmbedding, int topk)
+QVector<ScoredId> EmbeddingDatabase::fuseRanks(const QVector<float> &target, const QVector<int> &lexical, int topk, const QStringList &collections) const
 {
-	QSqlQuery query;
-	query.prepare("SELECT id, vector FROM embeddings_queue WHERE operation = 1");
+	QVector<ScoredId> semantic;
+	if (!target.isEmpty()) {
+		// The lexical hits are scored exactly as well, so a chunk that the
+		// approximate index missed still gets its true vector rank
+		TopK best(m_hybridDepth);
+		QSet<int> seen;
+		for (const ScoredId &hit : search(target.constData(), m_hybridDepth, collections)) {
+			best.push(hit.score, hit.seqId);
+			seen.insert(hit.seqId);
+		}
+		for (int seqId : lexical) {
+			const qsizetype row = m_store.rowOf(seqId);
+			if (row >= 0 && !seen.contains(seqId))
+				best.push(m_store.score(target.constData(), row), seqId);
+		}
+		semantic = best.sorted();
+	}
 
+	// Reciprocal rank fusion, only the ranks matter so BM25 and cosine scores
+	// need no calibration against each other
+	QHash<int, float> fused;
+	for (qsizetype i = 0; i < lexical.size(); ++i)
+		fused[lexical[i]] += 1.0f / (RrfConstant + i + 1);
+	for (qsizetype i = 0; i < semantic.size(); ++i)
+		fused[semantic[i].seqId] += 1.0f / (RrfConstant + i + 1);
+
+	TopK top(topk);
+	for (auto it = fused.constBegin(); it != fused.constEnd(); ++it)
+		top.push(it.value(), it.key());
+	return top.sorted();
+}
+
+QVector<int> EmbeddingDatabase::searchLexical(const QString &text, int limit, const QStringList &collections)
+{
+	if (!m_fullTextReady)
+		return {};
+
+	// Quote every term so part numbers and error codes are not parsed as FTS5
+	// operators, any term may match and BM25 ranks the chunks with most of them
+	static const QRegularExpression termPattern("\\w[\\w.\\-]*", QRegularExpression::UseUnicodePropertiesOption);
+	QStringList terms;
+	for (auto it = termPattern.globalMatch(text); it.hasNext();)
+		terms.append('"' + it.next().captured() + '"');
+	if (terms.isEmpty())
+		return {};
+
+	QSqlQuery scopedQuery;
+	if (!collections.isEmpty()) {
+		QStringList placeholders;
+		for (qsizetype i = 0; i < collections.size(); ++i)
+			placeholders.append("?");
+		scopedQuery.prepare("SELECT embeddings_fts.rowid FROM embeddings_fts "
+							"JOIN embeddings_queue ON embeddings_queue.seq_id = embeddings_fts.rowid "
+							"WHERE embeddings_fts MATCH ? AND embeddings_queue.collection IN (" + placeholders.join(',') + ") "
+							"ORDER BY rank LIMIT ?");
+		scopedQuery.addBindValue(terms.join(" OR "));
+		for (const QString &collection : collections)
+			scopedQuery.addBindValue(collection);
+		scopedQuery.addBindValue(limit);
+	}
+
+	QSqlQuery &query = collections.isEmpty() ? statement("SELECT rowid FROM embeddings_fts WHERE embeddings_fts MATCH :query ORDER BY rank LIMIT :limit")
+											 : scopedQuery;
+	if (collections.isEmpty()) {
+		query.bindValue(":query", terms.join(" OR "));
+		query.bindValue(":limit", limit);
+	}
 	if (!query.exec()) {
-		emit error("Error selecting documents: " + query.lastError().text());
+		emit error("Error searching embeddings_fts: " + query.lastError().text());
 		return {};
 	}
 
-	QVector<Document> closestDocuments;
-	while (query.next()) {
-		QString id = query.value("id").toString();
-		const QByteArray vectorData = query.value("vector").toByteArray();
-		if (vectorData.isEmpty()) {
-			qWarning() << "Empty embedding for document with id" << id << query.lastError().text();
-			continue;
+	QVector<int> seqIds;
+	while (query.next())
+		seqIds.append(query.value(0).toInt());
+	query.finish();
+	return seqIds;
+}
+
+void EmbeddingDatabase::setHybridDepth(int depth)
+{
+	waitForSearches();
+	m_hybridDepth = qMax(1, depth);
+}
+
+QVector<ScoredId> EmbeddingDatabase::search(const float *target, int topk, const QStringList &collections) const
+{
+	if (!collections.isEmpty())
+		return searchPartitions(target, topk, collections);
+
+	switch (m_searchMode) {
+	case SearchMode::Hnsw:
+		if (m_hnswReady) {
+			// a graph that cannot reach enough live nodes must not hide rows
+			QVector<ScoredId> hits = m_hnsw.search(target, topk);
+			if (hits.size() >= qMin<qsizetype>(topk, m_store.size()))
+				return hits;
 		}
+		break;
+	case SearchMode::IvfPq:
+		if (m_ivfpqReady)
+			return searchIvfPq(target, topk);
+		break;
+	case SearchMode::Binary:
+		if (m_binaryReady)
+			return searchBinary(target, topk);
+		break;
+	case SearchMode::Exact:
+		break;
+	}
+	return searchExact(target, topk);
+}
 
-		QVector<double> embedding;
-		embedding.resize(vectorData.size() / sizeof(double));
-		std::memcpy(embedding.data(), vectorData.constData(), vectorData.size());
+QVector<ScoredId> EmbeddingDatabase::searchExact(const float *target, int topk) const
+{
+	constexpr qsizetype blockSize = 1024;
+	const qsizetype rows = m_store.size();
+	if (rows == 0)
+		return {};
+
+	// The rows are cut into contiguous shards of whole blocks, about four
+	// per thread. Workers pull shards until none are left, so each streams
+	// long runs of the matrix, and threads that finish early take over from
+	// slow ones. Every worker keeps a local top-k; these are merged at the end.
+	const int threads = qMax(1, m_searchPool.maxThreadCount());
+	const qsizetype shardRows = qMax<qsizetype>(MinShardRows, (rows / (4 * threads) + blockSize - 1) / blockSize * blockSize);
+	const int shards = int((rows + shardRows - 1) / shardRows);
+	const int workers = qMin(threads, shards);
+
+	std::atomic<int> nextShard{0};
+	std::vector<TopK> results(workers, TopK(topk));
+	auto work = [&](int worker) {
+		float scores[blockSize];
+		TopK &best = results[worker];
+		for (int shard = nextShard++; shard < shards; shard = nextShard++) {
+			const qsizetype end = qMin(rows, (shard + 1) * shardRows);
+			for (qsizetype begin = shard * shardRows; begin < end; begin += blockSize) {
+				const qsizetype count = qMin(blockSize, end - begin);
+				m_store.scoreBatch(target, begin, count, scores);
+				for (qsizetype i = 0; i < count; ++i) {
+					if (best.accepts(scores[i]))
+						best.push(scores[i], m_store.seqId(begin + i));
+				}
+			}
+		}
+	};
 
-		const double similarity = calculateSimilarity(targetEmbedding, embedding);
-		closestDocuments.append({id, "", -1, similarity});
+	// the calling thread works on shards as well
+	QSemaphore done;
+	for (int worker = 1; worker < workers; ++worker) {
+		m_searchPool.start([&work, &done, worker]() {
+			work(worker);
+			done.release();
+		});
 	}
+	work(0);
+	done.acquire(workers - 1);
 
-	// Sort documents by similarity and return the top k
-	std::sort(closestDocuments.begin(), closestDocuments.end(), [](const Document& a, const Document& b) {
-		return a.value > b.value;
-	});
-	closestDocuments = closestDocuments.mid(0, topk);
-
-	// Populate text and other metadata
-	for (Document& doc : closestDocuments) {
-		QSqlQuery metadataQuery;
-		metadataQuery.prepare("SELECT seq_id, topic FROM embeddings_queue WHERE id = :id");
-		metadataQuery.bindValue(":id", doc.id);
-		if (!metadataQuery.exec()) {
-			emit error("Error selecting metadata: " + metadataQuery.lastError().text());
+	TopK best(topk);
+	for (const TopK &result : results)
+		best.merge(result);
+	return best.sorted();
+}
+
+QVector<ScoredId> EmbeddingDatabase::searchPartitions(const float *target, int topk, const QStringList &collections) const
+{
+	// Scoped queries score only the rows of their collections, exactly; a
+	// few documents are far fewer rows than any index would visit
+	const QSet<QString> unique(collections.begin(), collections.end());
+	TopK best(topk);
+	for (const QString &collection : unique) {
+		const auto partition = m_partitions.constFind(collection);
+		if (partition == m_partitions.constEnd())
 			continue;
+		for (int seqId : *partition) {
+			const float score = m_store.score(target, m_store.rowOf(seqId));
+			if (best.accepts(score))
+				best.push(score, seqId);
 		}
+	}
+	return best.sorted();
+}
 
-		if (metadataQuery.next()) {
-			doc.text = metadataQuery.value("topic").toString();
-			doc.index = metadataQuery.value("seq_id").toInt();
-		}
+void EmbeddingDatabase::setSearchThreads(int threads)
+{
+	waitForSearches();
+	m_searchPool.setMaxThreadCount(qMax(1, threads));
+}
+
+void EmbeddingDatabase::waitForSearches()
+{
+	m_queryPool.waitForDone();
+}
+
+QVector<ScoredId> EmbeddingDatabase::searchIvfPq(const float *target, int topk) const
+{
+	const int depth = m_ivfpq.parameters().rerankDepth;
+	if (depth <= 0)
+		return m_ivfpq.search(target, topk);
+
+	// Rescore the best approximate candidates with the exact vectors
+	TopK best(topk);
+	for (const ScoredId &candidate : m_ivfpq.search(target, qMax(depth, topk))) {
+		const qsizetype row = m_store.rowOf(candidate.seqId);
+		if (row >= 0)
+			best.push(m_store.score(target, row), candidate.seqId);
+	}
+	return best.sorted();
+}
+
+QVector<ScoredId> EmbeddingDatabase::searchBinary(const float *target, int topk) const
+{
+	// Sign codes only order the corpus roughly, the final ranking always
+	// comes from the exact vectors
+	TopK best(topk);
+	for (const ScoredId &candidate : m_binary.search(target, qMax(m_binaryRerankDepth, topk))) {
+		const qsizetype row = m_store.rowOf(candidate.seqId);
+		if (row >= 0)
+			best.push(m_store.score(target, row), candidate.seqId);
+	}
+	return best.sorted();
+}
+
+QVector<Document> EmbeddingDatabase::fetchDocuments(const QVector<ScoredId> &hits)
+{
+	if (hits.isEmpty())
+		return {};
+
+	// Fetch text and metadata of all hits in one primary key lookup
+	QStringList placeholders;
+	for (qsizetype i = 0; i < hits.size(); ++i)
+		placeholders.append("?");
+
+	QSqlQuery metadataQuery;
+	metadataQuery.prepare("SELECT seq_id, id, topic FROM embeddings_queue WHERE seq_id IN (" + placeholders.join(',') + ")");
+	for (const ScoredId &hit : hits)
+		metadataQuery.addBindValue(hit.seqId);
+
+	if (!metadataQuery.exec()) {
+		emit error("Error selecting metadata: " + metadataQuery.lastError().text());
+		return {};
+	}
+
+	QHash<int, Document> bySeqId;
+	while (metadataQuery.next()) {
+		Document doc;
+		doc.index = metadataQuery.value(0).toInt();
+		doc.id = metadataQuery.value(1).toString();
+		doc.text = metadataQuery.value(2).toString();
+		bySeqId.insert(doc.index, doc);
+	}
+
+	QVector<Document> closestDocuments;
+	closestDocuments.reserve(hits.size());
+	for (const ScoredId &hit : hits) {
+		auto it = bySeqId.find(hit.seqId);
+		if (it == bySeqId.end())
+			continue;
+		it->value = hit.score;
+		closestDocuments.append(*it);
 	}
 
 	return closestDocuments;
 }
 
+QVector<float> EmbeddingDatabase::documentVectors(const QVector<Document> &documents) const
+{
+	const int stride = m_store.stride();
+	QVector<float> vectors(documents.size() * stride, 0.0f);
+	for (qsizetype i = 0; i < documents.size(); ++i) {
+		const qsizetype row = m_store.rowOf(documents[i].index);
+		if (row >= 0)
+			m_store.decode(row, vectors.data() + i * stride);
+	}
+	return vectors;
+}
+
 std::optional<Document> EmbeddingDatabase::documentByIndex(int index)
 {
 	QSqlQuery query;
@@ -203,52 +680,217 @@ std::optional<Document> EmbeddingDatabase::documentByIndex(int index)
 	return {};
 }
 
-double EmbeddingDatabase::calculateSimilarity(const QVector<double> &embedding1, const QVector<double> &embedding2)
+std::optional<QVector<double>> EmbeddingDatabase::cachedEmbedding(const QString &model, const QString &text)
+{
+	QSqlQuery &query = statement("SELECT vector FROM embedding_cache WHERE model = :model AND hash = :hash");
+	query.bindValue(":model", model);
+	query.bindValue(":hash", textHash(text));
+	if (!query.exec() || !query.next())
+		return std::nullopt;
+
+	const QByteArray data = query.value(0).toByteArray();
+	query.finish();
+	QVector<float> vector;
+	if (!VectorCodec::decode(data, VectorEncoding::Float32, vector))
+		return std::nullopt;
+	return QVector<double>(vector.begin(), vector.end());
+}
+
+void EmbeddingDatabase::cacheEmbedding(const QString &model, const QString &text, const QVector<double> &embedding)
+{
+	if (embedding.isEmpty())
+		return;
+
+	// float32 is what the models produce, the store encoding is applied later
+	QSqlQuery &query = statement("INSERT OR REPLACE INTO embedding_cache (model, hash, vector) VALUES (:model, :hash, :vector)");
+	query.bindValue(":model", model);
+	query.bindValue(":hash", textHash(text));
+	query.bindValue(":vector", VectorCodec::encode(embedding, VectorEncoding::Float32));
+	if (!query.exec())
+		qWarning() << "Error caching embedding:" << query.lastError().text();
+}
+
+QVector<FileFingerprint> EmbeddingDatabase::fileManifest()
+{
+	QSqlQuery query;
+	if (!query.exec("SELECT path, size, modified, hash, pages FROM files")) {
+		emit error("Error selecting files: " + query.lastError().text());
+		return {};
+	}
+
+	QVector<FileFingerprint> files;
+	while (query.next())
+		files.append({ query.value(0).toString(), query.value(1).toLongLong(), query.value(2).toLongLong(),
+					   query.value(3).toByteArray(), query.value(4).toInt() });
+	return files;
+}
+
+void EmbeddingDatabase::updateFileManifest(const FileFingerprint &file)
+{
+	QSqlQuery query;
+	query.prepare("INSERT OR REPLACE INTO files (path, size, modified, hash, pages) VALUES (:path, :size, :modified, :hash, :pages)");
+	query.bindValue(":path", file.path);
+	query.bindValue(":size", file.size);
+	query.bindValue(":modified", file.modified);
+	query.bindValue(":hash", file.hash);
+	query.bindValue(":pages", file.pages);
+	if (!query.exec())
+		emit error("Error updating file manifest: " + query.lastError().text());
+}
+
+void EmbeddingDatabase::removeFromFileManifest(const QString &path)
+{
+	QSqlQuery query;
+	query.prepare("DELETE FROM files WHERE path = :path");
+	query.bindValue(":path", path);
+	if (!query.exec())
+		emit error("Error updating file manifest: " + query.lastError().text());
+}
+
+QByteArray EmbeddingDatabase::textHash(const QString &text)
+{
+	// chunks that only differ in whitespace share an embedding
+	return QCryptographicHash::hash(text.simplified().toUtf8(), QCryptographicHash::Sha256);
+}
+
+void EmbeddingDatabase::setSearchMode(SearchMode mode)
 {
-	// Calculate cosine similarity
+	waitForSearches();
+	m_searchMode = mode;
+	releaseIndexes();
+	if (m_searchMode == SearchMode::Hnsw && !m_hnswReady)
+		syncHnswIndex();
+	else if (m_searchMode == SearchMode::IvfPq && !m_ivfpqReady)
+		syncIvfPqIndex();
+	else if (m_searchMode == SearchMode::Binary && !m_binaryReady)
+		rebuildBinaryIndex();
+}
+
+void EmbeddingDatabase::setHnswParameters(const HnswIndex::Parameters &parameters)
+{
+	waitForSearches();
+	const bool rebuild = parameters.M != m_hnswParameters.M || parameters.efConstruction != m_hnswParameters.efConstruction;
+	m_hnswParameters = parameters;
+	m_hnsw.setEfSearch(parameters.efSearch);
+	if (rebuild && m_hnswReady)
+		rebuildHnswIndex();
+}
 
-	// Dot product
-	double dotProduct = 0.0;
-	for (int i = 0; i < embedding1.size(); ++i) {
-		dotProduct += embedding1[i] * embedding2[i];
+void EmbeddingDatabase::setIvfPqParameters(const IvfPqIndex::Parameters &parameters)
+{
+	waitForSearches();
+	m_ivfpqParameters = parameters;
+	m_ivfpq.setNprobe(parameters.nprobe);
+	m_ivfpq.setRerankDepth(parameters.rerankDepth);
+}
+
+void EmbeddingDatabase::setBinaryRerankDepth(int depth)
+{
+	waitForSearches();
+	m_binaryRerankDepth = qMax(depth, 0);
+}
+
+void EmbeddingDatabase::trainIvfPqIndex()
+{
+	waitForSearches();
+	m_ivfpqReady = false;
+	if (!m_ivfpq.train(m_store, m_ivfpqParameters)) {
+		qDebug() << "Not enough vectors to train the IVF-PQ index, using exact search";
+		return;
 	}
 
-	// Magnitudes
-	double magnitude1 = 0.0, magnitude2 = 0.0;
-	for (int i = 0; i < embedding1.size(); ++i) {
-		magnitude1 += embedding1[i] * embedding1[i];
-		magnitude2 += embedding2[i] * embedding2[i];
+	QVector<float> vector(m_store.stride());
+	for (qsizetype row = 0; row < m_store.size(); ++row) {
+		m_store.decode(row, vector.data());
+		m_ivfpq.add(m_store.seqId(row), vector.constData());
 	}
-	magnitude1 = std::sqrt(magnitude1);
-	magnitude2 = std::sqrt(magnitude2);
+	m_ivfpqReady = true;
+	m_ivfpqDirty = true;
+}
 
-	// Cosine similarity
-	return dotProduct / (magnitude1 * magnitude2);
+void EmbeddingDatabase::saveIndexes()
+{
+	if (m_vectorsDirty)
+		saveVectorFile();
+	if (m_hnswReady && m_hnswDirty) {
+		if (m_hnsw.save(indexFileName("hnsw")))
+			m_hnswDirty = false;
+		else
+			qWarning() << "Error saving HNSW index" << indexFileName("hnsw");
+	}
+	if (m_ivfpqReady && m_ivfpqDirty) {
+		if (m_ivfpq.save(indexFileName("ivfpq")))
+			m_ivfpqDirty = false;
+		else
+			qWarning() << "Error saving IVF-PQ index" << indexFileName("ivfpq");
+	}
 }
 
-bool EmbeddingDatabase::createConnection()
+bool EmbeddingDatabase::createConnection(const QString &fileName)
 {
 	m_db = QSqlDatabase::addDatabase("QSQLITE");
-	m_db.setDatabaseName("embeddings.db");
+	m_db.setDatabaseName(fileName);
 
 	if (!m_db.open()) {
 		emit error("Error opening database: " + m_db.lastError().text());
 		return false;
 	}
 
+	// WAL lets readers run during ingestion and, with synchronous = NORMAL,
+	// only syncs on checkpoints instead of on every commit
+	QSqlQuery query(m_db);
+	for (const char *pragma : { "PRAGMA journal_mode = WAL",
+								"PRAGMA synchronous = NORMAL",
+								"PRAGMA temp_store = MEMORY",
+								"PRAGMA cache_size = -65536",
+								"PRAGMA mmap_size = 268435456" }) {
+		if (!query.exec(pragma))
+			qWarning() << "Error setting" << pragma << query.lastError().text();
+	}
+
 	return true;
 }
 
+QSqlQuery &EmbeddingDatabase::statement(const QString &sql)
+{
+	auto it = m_statements.find(sql);
+	if (it == m_statements.end()) {
+		it = m_statements.insert(sql, QSqlQuery(m_db));
+		if (!it->prepare(sql))
+			qWarning() << "Error preparing" << sql << it->lastError().text();
+	}
+	return it.value();
+}
+
+void EmbeddingDatabase::beginBatch()
+{
+	if (m_batchDepth++ == 0 && !m_db.transaction())
+		qWarning() << "Error starting transaction:" << m_db.lastError().text();
+}
+
+void EmbeddingDatabase::commitBatch()
+{
+	Q_ASSERT(m_batchDepth > 0);
+	if (--m_batchDepth == 0 && !m_db.commit())
+		emit error("Error committing documents: " + m_db.lastError().text());
+}
+
 void EmbeddingDatabase::createTables()
 {
+	QSqlQuery query;
+
 	// check if tables already exist
 	QSqlQuery checkQuery;
 	checkQuery.prepare("SELECT name FROM sqlite_master WHERE type='table' AND name IN ('embeddings_queue', 'collections', 'collection_metadata')");
 	if (checkQuery.exec() && checkQuery.next()) {
+		migrateSchema();
+		createIndexes();
+		createEmbeddingCache();
+		createFileManifest();
+		createFullTextIndex();
 		return;
 	}
 
-	QSqlQuery query;
 	// Create embeddings_queue table
 	if (!query.exec("CREATE TABLE embeddings_queue ("
 					"seq_id INTEGER PRIMARY KEY, "
@@ -258,7 +900,8 @@ void EmbeddingDatabase::createTables()
 					"id TEXT NOT NULL, "
 					"vector BLOB, "
 					"encoding TEXT, "
-					"metadata TEXT)")) {
+					"metadata TEXT, "
+					"collection TEXT)")) {
 		emit error("Error creating embeddings_queue table: " + query.lastError().text());
 	}
 
@@ -270,4 +913,398 @@ void EmbeddingDatabase::createTables()
 					"UNIQUE (name))")) {
 		emit error("Error creating collections table: " + query.lastError().text());
 	}
+
+	createIndexes();
+	createEmbeddingCache();
+	createFileManifest();
+	createFullTextIndex();
+}
+
+void EmbeddingDatabase::createIndexes()
+{
+	QSqlQuery query;
+	if (!query.exec("CREATE INDEX IF NOT EXISTS embeddings_queue_id ON embeddings_queue (id)")) {
+		emit error("Error creating embeddings_queue index: " + query.lastError().text());
+	}
+	if (!query.exec("CREATE INDEX IF NOT EXISTS embeddings_queue_collection ON embeddings_queue (collection)")) {
+		emit error("Error creating embeddings_queue index: " + query.lastError().text());
+	}
+}
+
+void EmbeddingDatabase::migrateSchema()
+{
+	QSqlQuery query;
+	if (!query.exec("PRAGMA table_info(embeddings_queue)"))
+		return;
+	while (query.next()) {
+		if (query.value("name").toString() == "collection")
+			return;
+	}
+
+	// Databases from before the collection column: add it and assign the
+	// rows by their id, which starts with the collection's file name
+	if (!query.exec("ALTER TABLE embeddings_queue ADD COLUMN collection TEXT")) {
+		emit error("Error migrating embeddings_queue: " + query.lastError().text());
+		return;
+	}
+
+	// A file name shared by collections in different directories cannot
+	// tell their chunks apart, those rows keep no collection
+	const QStringList names = collections();
+	QHash<QString, int> fileNames;
+	for (const QString &name : names)
+		++fileNames[QFileInfo(name).fileName()];
+
+	m_db.transaction();
+	QSqlQuery update;
+	update.prepare("UPDATE embeddings_queue SET collection = :collection WHERE instr(id, :prefix) = 1");
+	for (const QString &name : names) {
+		if (fileNames.value(QFileInfo(name).fileName()) > 1) {
+			qWarning() << "Not assigning chunks to" << name << "- its file name is used by several collections";
+			continue;
+		}
+		update.bindValue(":collection", name);
+		update.bindValue(":prefix", QFileInfo(name).fileName() + ":");
+		if (!update.exec()) {
+			m_db.rollback();
+			emit error("Error migrating embeddings_queue: " + update.lastError().text());
+			return;
+		}
+	}
+	m_db.commit();
+}
+
+void EmbeddingDatabase::createEmbeddingCache()
+{
+	QSqlQuery query;
+	if (!query.exec("CREATE TABLE IF NOT EXISTS embedding_cache ("
+					"model TEXT NOT NULL, "
+					"hash BLOB NOT NULL, "
+					"vector BLOB NOT NULL, "
+					"PRIMARY KEY (model, hash)) WITHOUT ROWID")) {
+		emit error("Error creating embedding_cache table: " + query.lastError().text());
+	}
+}
+
+void EmbeddingDatabase::createFileManifest()
+{
+	QSqlQuery query;
+	if (!query.exec("CREATE TABLE IF NOT EXISTS files ("
+					"path TEXT PRIMARY KEY, "
+					"size INTEGER NOT NULL, "
+					"modified INTEGER NOT NULL, "
+					"hash BLOB, "
+					"pages INTEGER NOT NULL DEFAULT 0)")) {
+		emit error("Error creating files table: " + query.lastError().text());
+	}
+}
+
+void EmbeddingDatabase::createFullTextIndex()
+{
+	QSqlQuery query;
+	const bool exists = query.exec("SELECT 1 FROM sqlite_master WHERE type='table' AND name='embeddings_fts'") && query.next();
+
+	// External content table over the chunk text, the triggers keep it in step
+	// with embeddings_queue so every insert, delete and rename is covered
+	if (!query.exec("CREATE VIRTUAL TABLE IF NOT EXISTS embeddings_fts USING fts5("
+					"topic, content='embeddings_queue', content_rowid='seq_id')")) {
+		emit error("Error creating embeddings_fts table: " + query.lastError().text());
+		return;
+	}
+	const QStringList triggers = {
+		"CREATE TRIGGER IF NOT EXISTS embeddings_fts_insert AFTER INSERT ON embeddings_queue BEGIN "
+		"INSERT INTO embeddings_fts (rowid, topic) VALUES (new.seq_id, new.topic); END",
+		"CREATE TRIGGER IF NOT EXISTS embeddings_fts_delete AFTER DELETE ON embeddings_queue BEGIN "
+		"INSERT INTO embeddings_fts (embeddings_fts, rowid, topic) VALUES ('delete', old.seq_id, old.topic); END",
+		"CREATE TRIGGER IF NOT EXISTS embeddings_fts_update AFTER UPDATE OF topic ON embeddings_queue BEGIN "
+		"INSERT INTO embeddings_fts (embeddings_fts, rowid, topic) VALUES ('delete', old.seq_id, old.topic); "
+		"INSERT INTO embeddings_fts (rowid, topic) VALUES (new.seq_id, new.topic); END"
+	};
+	for (const QString &trigger : triggers) {
+		if (!query.exec(trigger)) {
+			emit error("Error creating embeddings_fts trigger: " + query.lastError().text());
+			return;
+		}
+	}
+
+	// Index the chunks of databases created before the full text index existed
+	if (!exists && !query.exec("INSERT INTO embeddings_fts (embeddings_fts) VALUES ('rebuild')")) {
+		emit error("Error building embeddings_fts index: " + query.lastError().text());
+		return;
+	}
+	m_fullTextReady = true;
+}
+
+void EmbeddingDatabase::loadVectors()
+{
+	m_partitions.clear();
+	if (mapVectorFile())
+		return;
+	// a full reset, clear() would keep the dimension and encoding of the
+	// vectors loaded before
+	m_store.reset(0, m_encoding);
+
+	QSqlQuery countQuery;
+	qsizetype rows = 0;
+	if (countQuery.exec("SELECT COUNT(*) FROM embeddings_queue WHERE operation = 1") && countQuery.next())
+		rows = countQuery.value(0).toLongLong();
+
+	QSqlQuery query;
+	query.setForwardOnly(true);
+	if (!query.exec("SELECT seq_id, id, vector, encoding, collection FROM embeddings_queue WHERE operation = 1")) {
+		emit error("Error loading embeddings: " + query.lastError().text());
+		return;
+	}
+
+	QVector<float> vector;
+	while (query.next()) {
+		const auto encoding = VectorCodec::fromName(query.value(3).toString());
+		const QByteArray vectorData = query.value(2).toByteArray();
+		if (vectorData.isEmpty() || !encoding || !VectorCodec::decode(vectorData, *encoding, vector)) {
+			qWarning() << "Invalid embedding for document with id" << query.value(1).toString();
+			continue;
+		}
+
+		const int dimension = vector.size();
+		if (m_store.dimension() == 0) {
+			m_store.reset(dimension, m_encoding);
+			m_store.reserve(rows);
+		}
+		if (dimension != m_store.dimension()) {
+			qWarning() << "Embedding dimension mismatch for document with id" << query.value(1).toString();
+			continue;
+		}
+
+		m_store.append(query.value(0).toInt(), query.value(1).toString(), vector.constData());
+		if (!query.isNull(4))
+			m_partitions[query.value(4).toString()].append(query.value(0).toInt());
+	}
+
+	saveVectorFile();
+}
+
+bool EmbeddingDatabase::mapVectorFile()
+{
+	const QString fileName = indexFileName("vectors");
+	if (!QFile::exists(fileName) || !m_store.map(fileName))
+		return false;
+
+	// SQLite stays the source of truth: the file is only used if it holds
+	// exactly the stored rows, in the encoding currently requested
+	const VectorEncoding encoding = m_encoding == VectorEncoding::Float64 ? VectorEncoding::Float32 : m_encoding;
+	bool consistent = m_store.encoding() == encoding;
+
+	QSqlQuery query;
+	query.setForwardOnly(true);
+	consistent = consistent && query.exec("SELECT seq_id, id, collection FROM embeddings_queue WHERE operation = 1");
+	qsizetype rows = 0;
+	while (consistent && query.next()) {
+		const qsizetype row = m_store.rowOf(query.value(0).toInt());
+		consistent = row >= 0;
+		if (consistent) {
+			m_store.setId(row, query.value(1).toString());
+			if (!query.isNull(2))
+				m_partitions[query.value(2).toString()].append(query.value(0).toInt());
+			++rows;
+		}
+	}
+
+	if (consistent && rows == m_store.size()) {
+		m_vectorsDirty = false;
+		return true;
+	}
+
+	qDebug() << "Vector file is stale, reloading the embeddings from the database";
+	m_store.clear();
+	m_partitions.clear();
+	return false;
+}
+
+void EmbeddingDatabase::saveVectorFile()
+{
+	const QString fileName = indexFileName("vectors");
+	if (m_store.dimension() == 0) {
+		QFile::remove(fileName);
+		m_vectorsDirty = false;
+		return;
+	}
+
+	if (m_store.save(fileName))
+		m_vectorsDirty = false;
+	else
+		qWarning() << "Error saving vector file" << fileName;
+}
+
+void EmbeddingDatabase::markVectorsDirty()
+{
+	// drop the persisted files on the first change, so a crash before
+	// saveIndexes() cannot leave a sidecar, graph or inverted lists that
+	// match reused seq_ids but were built from old vectors
+	if (!m_vectorsDirty) {
+		QFile::remove(indexFileName("vectors"));
+		QFile::remove(indexFileName("hnsw"));
+		QFile::remove(indexFileName("ivfpq"));
+		m_vectorsDirty = true;
+	}
+}
+
+void EmbeddingDatabase::migrateEncodings()
+{
+	if (m_encoding == VectorEncoding::Float64)
+		return;
+
+	// Rewrite legacy raw double rows in the compact default encoding
+	QSqlQuery query;
+	query.setForwardOnly(true);
+	if (!query.exec("SELECT seq_id, vector FROM embeddings_queue WHERE encoding IS NULL OR encoding = 'f64'")) {
+		emit error("Error selecting legacy embeddings: " + query.lastError().text());
+		return;
+	}
+
+	QVector<QPair<int, QByteArray>> rows;
+	QVector<double> embedding;
+	while (query.next()) {
+		const QByteArray vectorData = query.value(1).toByteArray();
+		if (vectorData.isEmpty())
+			continue;
+		embedding.resize(vectorData.size() / sizeof(double));
+		std::memcpy(embedding.data(), vectorData.constData(), embedding.size() * sizeof(double));
+		rows.append({ query.value(0).toInt(), VectorCodec::encode(embedding, m_encoding) });
+	}
+	query.finish();
+	if (rows.isEmpty())
+		return;
+
+	m_db.transaction();
+	QSqlQuery update;
+	update.prepare("UPDATE embeddings_queue SET vector = :vector, encoding = :encoding WHERE seq_id = :seq_id");
+	for (const auto &row : rows) {
+		update.bindValue(":vector", row.second);
+		update.bindValue(":encoding", VectorCodec::name(m_encoding));
+		update.bindValue(":seq_id", row.first);
+		if (!update.exec()) {
+			m_db.rollback();
+			emit error("Error migrating embeddings: " + update.lastError().text());
+			return;
+		}
+	}
+	m_db.commit();
+	qDebug() << "Migrated" << rows.size() << "embeddings to" << VectorCodec::name(m_encoding);
+}
+
+void EmbeddingDatabase::setVectorEncoding(VectorEncoding encoding)
+{
+	waitForSearches();
+	if (m_encoding == encoding)
+		return;
+
+	// new rows use the new encoding and the resident vectors are reloaded in
+	// it; existing rows keep the encoding they were written with
+	m_encoding = encoding;
+	loadVectors();
+}
+
+QString EmbeddingDatabase::indexFileName(const QString &suffix) const
+{
+	// Index files live next to the database, e.g. embeddings.hnsw
+	const QFileInfo info(m_db.databaseName());
+	return info.absoluteDir().filePath(info.completeBaseName() + "." + suffix);
+}
+
+void EmbeddingDatabase::syncHnswIndex()
+{
+	// the graph file is mapped and scores the store's rows, opening it
+	// reads no vectors
+	if (m_hnsw.load(indexFileName("hnsw"), &m_store)) {
+		// the persisted graph is only reused if it covers exactly the stored
+		// rows and is not dominated by tombstones
+		bool consistent = m_hnsw.size() == m_store.size()
+				&& m_hnsw.deletedCount() <= m_hnsw.size() * MaxHnswTombstones;
+		for (qsizetype row = 0; consistent && row < m_store.size(); ++row)
+			consistent = m_hnsw.contains(m_store.seqId(row));
+
+		if (consistent) {
+			m_hnswParameters.M = m_hnsw.parameters().M;
+			m_hnswParameters.efConstruction = m_hnsw.parameters().efConstruction;
+			m_hnsw.setEfSearch(m_hnswParameters.efSearch);
+			m_hnswReady = true;
+			m_hnswDirty = false;
+			return;
+		}
+		qDebug() << "HNSW index is stale, rebuilding";
+	}
+
+	rebuildHnswIndex();
+}
+
+void EmbeddingDatabase::rebuildHnswIndex()
+{
+	m_hnsw.reset(&m_store, m_hnswParameters);
+	QVector<float> vector(m_store.stride());
+	for (qsizetype row = 0; row < m_store.size(); ++row) {
+		m_store.decode(row, vector.data());
+		m_hnsw.insert(m_store.seqId(row), vector.constData());
+	}
+	m_hnswReady = true;
+	m_hnswDirty = true;
+}
+
+void EmbeddingDatabase::syncIvfPqIndex()
+{
+	if (m_ivfpq.load(indexFileName("ivfpq")) && m_ivfpq.dimension() == m_store.dimension()) {
+		// keep the trained quantizers, but re-encode the rows if the lists
+		// no longer match the database
+		bool consistent = m_ivfpq.size() == m_store.size();
+		for (qsizetype row = 0; consistent && row < m_store.size(); ++row)
+			consistent = m_ivfpq.contains(m_store.seqId(row));
+
+		m_ivfpqDirty = !consistent;
+		if (!consistent) {
+			qDebug() << "IVF-PQ lists are stale, re-encoding";
+			m_ivfpq.removeAll();
+			QVector<float> vector(m_store.stride());
+			for (qsizetype row = 0; row < m_store.size(); ++row) {
+				m_store.decode(row, vector.data());
+				m_ivfpq.add(m_store.seqId(row), vector.constData());
+			}
+		}
+		m_ivfpq.setNprobe(m_ivfpqParameters.nprobe);
+		m_ivfpq.setRerankDepth(m_ivfpqParameters.rerankDepth);
+		m_ivfpqReady = true;
+		return;
+	}
+
+	trainIvfPqIndex();
+}
+
+void EmbeddingDatabase::releaseIndexes()
+{
+	// Ready indexes are updated on every insert, so those of other modes
+	// would slow ingestion down. A clean one is loaded again from its file.
+	if (m_searchMode != SearchMode::Hnsw && m_hnswReady) {
+		m_hnsw.clear();
+		m_hnswReady = false;
+		m_hnswDirty = false;
+	}
+	if (m_searchMode != SearchMode::IvfPq && m_ivfpqReady) {
+		m_ivfpq.clear();
+		m_ivfpqReady = false;
+		m_ivfpqDirty = false;
+	}
+	if (m_searchMode != SearchMode::Binary && m_binaryReady) {
+		m_binary.clear();
+		m_binaryReady = false;
+	}
+}
+
+void EmbeddingDatabase::rebuildBinaryIndex()
+{
+	// The codes are cheap to derive from the store, so they are not persisted
+	m_binary.reset(m_store.dimension());
+	QVector<float> vector(m_store.stride());
+	for (qsizetype row = 0; row < m_store.size(); ++row) {
+		m_store.decode(row, vector.data());
+		m_binary.add(m_store.seqId(row), vector.constData());
+	}
+	m_binaryReady = true;
 }
@@ -27,6 +27,16 @@
 #include <QtSql>
 #include <QObject>
 #include <QSqlDatabase>
+#include <QThreadPool>
+
+#include <functional>
+
+#include "VectorStore.h"
+#include "HnswIndex.h"
+#include "IvfPqIndex.h"
+#include "BinaryIndex.h"
+#include "TopK.h"
+#include "FileManifest.h"
 
 struct Document {
 	QString id;
@@ -39,30 +49,164 @@ class EmbeddingDatabase : public QObject
 {
 	Q_OBJECT
 public:
+	enum class SearchMode {
+		Exact, // brute force scan over all vectors, used for recall checks
+		Hnsw,  // approximate search on the HNSW graph
+		IvfPq, // compressed inverted file search with exact rerank
+		Binary // Hamming distance prefilter on sign bits with exact rerank
+	};
+
 	EmbeddingDatabase(QObject *parent = nullptr);
+	// `mode` is set before any index is loaded or built
+	explicit EmbeddingDatabase(const QString &fileName, SearchMode mode = SearchMode::Hnsw, QObject *parent = nullptr);
+	~EmbeddingDatabase();
 
 	void addCollection(const QString& collection);
+	void removeCollection(const QString& collection);
+	void renameCollection(const QString& collection, const QString& name);
 	bool hasCollection(const QString& collection);
 	QStringList collections();
 	QString collectionByIndex(int index);
 
-	void addDocument(const QString& id, const QString& topic, const QVector<double>& embedding);
+	void addDocument(const QString& id, const QString& topic, const QVector<double>& embedding, const QString& collection = QString());
 	bool removeDocument(const QString& id);
 
-	QVector<Document> findDocuments(const QVector<double>& targetEmbedding, int topk = 5);
+	// Writes between these calls share one transaction, calls can nest
+	void beginBatch();
+	void commitBatch();
+	// All chunks stored for a collection, uses the collection index
+	int removeCollectionDocuments(const QString& collection);
+	// Chunk ids start with the file name, renames them within a collection
+	bool renameDocuments(const QString& collection, const QString& oldPrefix, const QString& newPrefix);
+
+	// A non-empty `collections` limits the search to the chunks of those
+	// collections, which are scored from their own partitions
+	QVector<Document> findDocuments(const QVector<double>& targetEmbedding, int topk = 5, const QStringList& collections = {});
+	// BM25 keyword search and vector search fused by reciprocal rank
+	QVector<Document> findDocumentsHybrid(const QVector<double>& targetEmbedding, const QString& text, int topk = 5,
+										  const QStringList& collections = {});
+	// Runs the vector search off the calling thread and hands the documents
+	// to `callback` on this object's thread. Hybrid if `text` is not empty.
+	void findDocumentsAsync(const QVector<double>& targetEmbedding, const QString& text, int topk, const QStringList& collections,
+							std::function<void(const QVector<Document>&)> callback);
 
 	std::optional<Document> documentByIndex(int index);
+	inline qsizetype documentCount() const { return m_store.size(); }
+	inline int dimension() const { return m_store.dimension(); }
+	// Unit length vectors of the documents, vectorStride() floats each and
+	// zeros for documents that have none
+	QVector<float> documentVectors(const QVector<Document>& documents) const;
+	inline int vectorStride() const { return m_store.stride(); }
+	inline QString fileName() const { return m_db.databaseName(); }
+
+	// Embeddings cached by model and hash of the whitespace normalized text
+	std::optional<QVector<double>> cachedEmbedding(const QString& model, const QString& text);
+	void cacheEmbedding(const QString& model, const QString& text, const QVector<double>& embedding);
+	static QByteArray textHash(const QString& text);
+
+	QVector<FileFingerprint> fileManifest();
+	void updateFileManifest(const FileFingerprint& file);
+	void removeFromFileManifest(const QString& path);
+
+	// Indexes the new mode does not use are dropped, not kept up to date
+	void setSearchMode(SearchMode mode);
+	inline SearchMode searchMode() const { return m_searchMode; }
+
+	void setHnswParameters(const HnswIndex::Parameters &parameters);
+	inline HnswIndex::Parameters hnswParameters() const { return m_hnswParameters; }
+
+	void setIvfPqParameters(const IvfPqIndex::Parameters &parameters);
+	inline IvfPqIndex::Parameters ivfPqParameters() const { return m_ivfpqParameters; }
+	void trainIvfPqIndex();
+
+	// Number of Hamming candidates rescored with the stored vectors
+	void setBinaryRerankDepth(int depth);
+	inline int binaryRerankDepth() const { return m_binaryRerankDepth; }
+
+	// Threads of the exact scan, defaults to the number of cores
+	void setSearchThreads(int threads);
+	inline int searchThreads() const { return m_searchPool.maxThreadCount(); }
+
+	// Number of candidates taken from each of the hybrid search stages
+	void setHybridDepth(int depth);
+	inline int hybridDepth() const { return m_hybridDepth; }
+
+	void saveIndexes();
+
+	void setVectorEncoding(VectorEncoding encoding);
+	inline VectorEncoding vectorEncoding() const { return m_encoding; }
+	// the encoding the resident vectors are scored in
+	inline VectorEncoding residentEncoding() const { return m_store.encoding(); }
 
 signals:
 	void error(const QString& message);
 
 private:
-	double calculateSimilarity(const QVector<double>& embedding1, const QVector<double>& embedding2);
+	QVector<ScoredId> search(const float *target, int topk, const QStringList &collections = {}) const;
+	QVector<ScoredId> searchPartitions(const float *target, int topk, const QStringList &collections) const;
+	QVector<ScoredId> searchExact(const float *target, int topk) const;
+	QVector<ScoredId> searchIvfPq(const float *target, int topk) const;
+	QVector<ScoredId> searchBinary(const float *target, int topk) const;
+	QVector<int> searchLexical(const QString &text, int limit, const QStringList &collections = {});
+	bool queryVector(const QVector<double> &embedding, QVector<float> &target);
+	QVector<ScoredId> fuseRanks(const QVector<float> &target, const QVector<int> &lexical, int topk, const QStringList &collections) const;
+	// Writes must not overlap an asynchronous search
+	void waitForSearches();
+	QVector<Document> fetchDocuments(const QVector<ScoredId> &hits);
+	int removeRows(const QString &condition, const QString &id);
 
-	bool createConnection();
+	bool createConnection(const QString &fileName);
+	QSqlQuery &statement(const QString &sql);
 	void createTables();
+	void createIndexes();
+	void migrateSchema();
+	void createEmbeddingCache();
+	void createFileManifest();
+	void createFullTextIndex();
+	void loadVectors();
+	bool mapVectorFile();
+	void saveVectorFile();
+	void markVectorsDirty();
+	void migrateEncodings();
+
+	QString indexFileName(const QString &suffix) const;
+	void syncHnswIndex();
+	void rebuildHnswIndex();
+	void syncIvfPqIndex();
+	void rebuildBinaryIndex();
+	void releaseIndexes();
 
 	QSqlDatabase m_db;
+	QHash<QString, QSqlQuery> m_statements; // prepared once, reused
+	int m_batchDepth = 0;
+	VectorEncoding m_encoding = VectorEncoding::Float16;
+	VectorStore m_store;
+	QHash<QString, QVector<int>> m_partitions; // seq_ids of the resident rows by collection
+	bool m_vectorsDirty = false;
+
+	SearchMode m_searchMode = SearchMode::Hnsw;
+	HnswIndex m_hnsw;
+	HnswIndex::Parameters m_hnswParameters;
+	bool m_hnswReady = false;
+	bool m_hnswDirty = false;
+	static constexpr double MaxHnswTombstones = 0.25; // per live node, more rebuild the graph
+
+	IvfPqIndex m_ivfpq;
+	IvfPqIndex::Parameters m_ivfpqParameters;
+	bool m_ivfpqReady = false;
+	bool m_ivfpqDirty = false;
+
+	BinaryIndex m_binary;
+	int m_binaryRerankDepth = 256;
+	bool m_binaryReady = false;
+
+	static constexpr qsizetype MinShardRows = 16384;
+	mutable QThreadPool m_searchPool;
+	QThreadPool m_queryPool;
+
+	static constexpr int RrfConstant = 60;
+	int m_hybridDepth = 100;
+	bool m_fullTextReady = false;
 };
 
 #endif // EMBEDDINGDATABASE_H
@@ -0,0 +1,124 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "FileManifest.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+
+#include <utility>
+
+namespace FileManifest
+{
+
+FileFingerprint fingerprint(const QFileInfo &file, bool withHash)
+{
+	FileFingerprint result;
+	result.path = file.absoluteFilePath();
+	result.size = file.size();
+	result.modified = file.lastModified().toMSecsSinceEpoch();
+	if (withHash)
+		result.hash = hashFile(result.path);
+	return result;
+}
+
+QByteArray hashFile(const QString &path)
+{
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly))
+		return {};
+
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	if (!hash.addData(&file))
+		return {};
+	return hash.result();
+}
+
+Diff diff(const QVector<FileFingerprint> &manifest, const QFileInfoList &files)
+{
+	QHash<QString, FileFingerprint> known;
+	for (const FileFingerprint &entry : manifest)
+		known.insert(entry.path, entry);
+
+	Diff result;
+	QVector<FileFingerprint> added;
+	for (const QFileInfo &file : files) {
+		FileFingerprint current = fingerprint(file);
+		auto it = known.find(current.path);
+		if (it == known.end()) {
+			added.append(current);
+			continue;
+		}
+
+		const FileFingerprint previous = it.value();
+		known.erase(it);
+		if (current.size != previous.size) {
+			result.changed.append(current);
+		} else if (current.modified == previous.modified) {
+			result.unchanged.append(previous);
+		} else {
+			current.hash = hashFile(current.path);
+			current.pages = previous.pages;
+			if (!current.hash.isEmpty() && current.hash == previous.hash)
+				result.touched.append(current);
+			else
+				result.changed.append(current);
+		}
+	}
+
+	// whatever is left in the manifest is gone from disk, unless a new file
+	// has the same content
+	QHash<QByteArray, FileFingerprint> removedByHash;
+	QSet<qint64> removedSizes;
+	for (const FileFingerprint &entry : std::as_const(known)) {
+		if (!entry.hash.isEmpty()) {
+			removedByHash.insert(entry.hash, entry);
+			removedSizes.insert(entry.size);
+		}
+	}
+
+	for (FileFingerprint &current : added) {
+		if (removedSizes.contains(current.size)) {
+			current.hash = hashFile(current.path);
+			auto it = removedByHash.find(current.hash);
+			if (!current.hash.isEmpty() && it != removedByHash.end() && it->size == current.size) {
+				current.pages = it->pages;
+				result.moved.append({ it.value(), current });
+				known.remove(it->path);
+				removedByHash.erase(it);
+				continue;
+			}
+		}
+		result.added.append(current);
+	}
+
+	for (const FileFingerprint &entry : std::as_const(known))
+		result.removed.append(entry);
+
+	return result;
+}
+
+} // namespace FileManifest
@@ -0,0 +1,64 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FILEMANIFEST_H
+#define FILEMANIFEST_H
+
+#include <QFileInfo>
+#include <QPair>
+#include <QVector>
+
+// What was ingested from a source file. Size and modification time decide
+// whether a file has to be looked at again; the content hash identifies
+// touched and moved files.
+struct FileFingerprint {
+	QString path;
+	qint64 size = 0;
+	qint64 modified = 0; // ms since epoch
+	QByteArray hash;
+	int pages = 0;
+};
+
+namespace FileManifest
+{
+
+struct Diff {
+	QVector<FileFingerprint> added;
+	QVector<FileFingerprint> changed;
+	QVector<FileFingerprint> removed;
+	QVector<QPair<FileFingerprint, FileFingerprint>> moved; // from, to
+	QVector<FileFingerprint> touched; // same content, new modification time
+	QVector<FileFingerprint> unchanged;
+};
+
+FileFingerprint fingerprint(const QFileInfo &file, bool withHash = false);
+QByteArray hashFile(const QString &path);
+
+// Compares the files on disk with the manifest. Only files whose size
+// matches but whose time changed, and new files that have the size of a
+// removed one, are hashed; everything else is decided by stat alone.
+Diff diff(const QVector<FileFingerprint> &manifest, const QFileInfoList &files);
+
+} // namespace FileManifest
+
+#endif // FILEMANIFEST_H
@@ -0,0 +1,499 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "HnswIndex.h"
+#include "SimilarityKernels.h"
+#include "VectorStore.h"
+
+#include <QFile>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+
+namespace
+{
+
+constexpr quint32 HnswMagic = 0x57534e48; // "HNSW"
+constexpr quint32 HnswVersion = 2;
+
+// Followed by the labels and levels, the level 0 links, the upper links and
+// one tombstone byte per node. Every array of ints stays 4 byte aligned in
+// the mapping.
+struct HnswFileHeader {
+	quint32 magic;
+	quint32 version;
+	qint32 dimension;
+	qint32 M;
+	qint32 efConstruction;
+	qint32 efSearch;
+	qint32 entryPoint;
+	qint32 maxLevel;
+	qint64 count;
+	qint64 deletedCount;
+	qint64 upperSize;
+};
+
+constexpr float Unreachable = -std::numeric_limits<float>::infinity();
+
+} // namespace
+
+HnswIndex::~HnswIndex()
+{
+	clear();
+}
+
+void HnswIndex::reset(const VectorStore *store, const Parameters &parameters)
+{
+	clear();
+	m_parameters = parameters;
+	m_parameters.M = qMax(2, m_parameters.M);
+	m_parameters.efConstruction = qMax(m_parameters.M, m_parameters.efConstruction);
+	m_parameters.efSearch = qMax(1, m_parameters.efSearch);
+	m_store = store;
+	m_dimension = store ? store->dimension() : 0;
+	m_levelMultiplier = 1.0 / std::log(double(m_parameters.M));
+}
+
+void HnswIndex::clear()
+{
+	m_entryPoint = -1;
+	m_maxLevel = -1;
+	m_deletedCount = 0;
+	m_level0.clear();
+	m_upper.clear();
+	m_level0Links = nullptr;
+	m_upperLinks = nullptr;
+	m_upperOffset.clear();
+	m_levels.clear();
+	m_labels.clear();
+	m_deleted.clear();
+	m_nodeByLabel.clear();
+	m_file.reset(); // unmaps the links
+}
+
+void HnswIndex::setEfSearch(int efSearch)
+{
+	m_parameters.efSearch = qMax(1, efSearch);
+}
+
+void HnswIndex::insert(int label, const float *vector)
+{
+	Q_ASSERT(m_store && m_dimension > 0);
+	detach();
+	markDeleted(label);
+
+	const int node = int(m_labels.size());
+	const int level = randomLevel();
+
+	m_labels.push_back(label);
+	m_deleted.push_back(0);
+	m_levels.push_back(level);
+	m_upperOffset.push_back(qsizetype(m_upper.size()));
+	m_level0.resize(m_level0.size() + maxLinks(0) + 1, 0);
+	m_upper.resize(m_upper.size() + std::size_t(level) * (maxLinks(1) + 1), 0);
+	m_level0Links = m_level0.data();
+	m_upperLinks = m_upper.data();
+	m_nodeByLabel.insert(label, node);
+
+	if (m_entryPoint < 0) {
+		m_entryPoint = node;
+		m_maxLevel = level;
+		return;
+	}
+
+	const int entry = greedySearch(vector, m_entryPoint, m_maxLevel, level);
+
+	std::vector<Candidate> entries{{similarity(vector, entry), entry}};
+	for (int l = qMin(level, m_maxLevel); l >= 0; --l) {
+		std::vector<Candidate> found = searchLayer(vector, entries, m_parameters.efConstruction, l);
+		// only tombstones were reached: link to the live entry point rather
+		// than leave the node unreachable
+		if (found.empty() && !m_deleted[m_entryPoint])
+			found.push_back({similarity(vector, m_entryPoint), m_entryPoint});
+		std::vector<Candidate> neighbors = found;
+		selectNeighbors(neighbors, m_parameters.M);
+		connect(node, neighbors, l);
+		if (!found.empty())
+			entries = std::move(found);
+	}
+
+	if (level > m_maxLevel) {
+		m_entryPoint = node;
+		m_maxLevel = level;
+	}
+}
+
+bool HnswIndex::markDeleted(int label)
+{
+	auto it = m_nodeByLabel.find(label);
+	if (it == m_nodeByLabel.end())
+		return false;
+
+	// a changed graph is saved over the mapped file, so it leaves the mapping
+	detach();
+	const int node = it.value();
+	m_deleted[node] = 1;
+	++m_deletedCount;
+	m_nodeByLabel.erase(it);
+
+	// searches and inserts start from a live node, the highest one left
+	if (node == m_entryPoint) {
+		m_entryPoint = -1;
+		m_maxLevel = -1;
+		for (int other = 0; other < int(m_labels.size()); ++other) {
+			if (!m_deleted[other] && m_levels[other] > m_maxLevel) {
+				m_entryPoint = other;
+				m_maxLevel = m_levels[other];
+			}
+		}
+	}
+	return true;
+}
+
+QVector<ScoredId> HnswIndex::search(const float *query, int topk) const
+{
+	if (m_entryPoint < 0 || topk <= 0)
+		return {};
+
+	const int entry = greedySearch(query, m_entryPoint, m_maxLevel, 0);
+	const std::vector<Candidate> found = searchLayer(query, {{similarity(query, entry), entry}},
+													 qMax(m_parameters.efSearch, topk), 0);
+
+	QVector<ScoredId> result;
+	result.reserve(qMin<qsizetype>(topk, found.size()));
+	for (const Candidate &candidate : found) {
+		if (result.size() >= topk)
+			break;
+		result.append({candidate.first, m_labels[candidate.second]});
+	}
+	return result;
+}
+
+bool HnswIndex::save(const QString &fileName) const
+{
+	QSaveFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+
+	const std::size_t count = m_labels.size();
+	const std::size_t upperSize = count > 0 ? std::size_t(m_upperOffset.back()) + std::size_t(m_levels.back()) * (maxLinks(1) + 1) : 0;
+
+	HnswFileHeader header;
+	header.magic = HnswMagic;
+	header.version = HnswVersion;
+	header.dimension = m_dimension;
+	header.M = m_parameters.M;
+	header.efConstruction = m_parameters.efConstruction;
+	header.efSearch = m_parameters.efSearch;
+	header.entryPoint = m_entryPoint;
+	header.maxLevel = m_maxLevel;
+	header.count = qint64(count);
+	header.deletedCount = m_deletedCount;
+	header.upperSize = qint64(upperSize);
+
+	auto write = [&file](const void *data, qint64 size) {
+		return size == 0 || file.write(static_cast<const char*>(data), size) == size;
+	};
+
+	const bool ok = write(&header, sizeof(header))
+			&& write(m_labels.data(), count * sizeof(int))
+			&& write(m_levels.data(), count * sizeof(int))
+			&& write(m_level0Links, count * (maxLinks(0) + 1) * sizeof(int))
+			&& write(m_upperLinks, upperSize * sizeof(int))
+			&& write(m_deleted.data(), count);
+
+	return ok && file.commit();
+}
+
+bool HnswIndex::load(const QString &fileName, const VectorStore *store)
+{
+	clear();
+
+	auto file = std::make_unique<QFile>(fileName);
+	if (!file->open(QIODevice::ReadOnly))
+		return false;
+
+	HnswFileHeader header;
+	if (file->read(reinterpret_cast<char*>(&header), sizeof(header)) != qint64(sizeof(header))
+			|| header.magic != HnswMagic || header.version != HnswVersion || header.M < 2
+			|| header.count < 0 || header.deletedCount < 0 || header.deletedCount > header.count || header.upperSize < 0)
+		return false;
+
+	// the graph is only usable with vectors of the dimension it was built on
+	if (!store || header.dimension <= 0 || header.dimension != store->dimension())
+		return false;
+
+	reset(store, { header.M, header.efConstruction, header.efSearch });
+	const qint64 count = header.count;
+	const qint64 level0Size = count * (maxLinks(0) + 1);
+	if (file->size() != qint64(sizeof(header)) + (2 * count + level0Size + header.upperSize) * qint64(sizeof(int)) + count)
+		return false;
+	if (count == 0)
+		return true;
+	if (header.entryPoint < 0 || header.entryPoint >= count || header.maxLevel < 0)
+		return false;
+
+	const uchar *base = file->map(0, file->size());
+	if (!base)
+		return false;
+
+	// labels, levels and tombstones are small and copied, the links stay in
+	// the mapping
+	const int *data = reinterpret_cast<const int*>(base + sizeof(header));
+	m_labels.assign(data, data + count);
+	data += count;
+	m_levels.assign(data, data + count);
+	data += count;
+	m_level0Links = data;
+	data += level0Size;
+	m_upperLinks = data;
+	data += header.upperSize;
+	const char *deleted = reinterpret_cast<const char*>(data);
+	m_deleted.assign(deleted, deleted + count);
+
+	bool ok = true;
+	qsizetype offset = 0;
+	m_upperOffset.resize(std::size_t(count));
+	for (qint64 node = 0; ok && node < count; ++node) {
+		ok = m_levels[node] >= 0 && m_levels[node] <= header.maxLevel;
+		m_upperOffset[node] = offset;
+		offset += qsizetype(m_levels[node]) * (maxLinks(1) + 1);
+	}
+	ok = ok && offset == header.upperSize
+			&& std::count(m_deleted.begin(), m_deleted.end(), char(1)) == header.deletedCount;
+	if (!ok) {
+		clear();
+		return false;
+	}
+
+	m_file = std::move(file);
+	m_entryPoint = header.entryPoint;
+	m_maxLevel = header.maxLevel;
+	m_deletedCount = header.deletedCount;
+	m_nodeByLabel.reserve(qsizetype(count - m_deletedCount));
+	for (qint64 node = 0; node < count; ++node) {
+		if (!m_deleted[node])
+			m_nodeByLabel.insert(m_labels[node], int(node));
+	}
+	return true;
+}
+
+float HnswIndex::similarity(const float *query, int node) const
+{
+	// tombstones have no row left to score, they never win a comparison
+	if (m_deleted[node])
+		return Unreachable;
+	const qsizetype row = m_store->rowOf(m_labels[node]);
+	return row >= 0 ? m_store->score(query, row) : Unreachable;
+}
+
+bool HnswIndex::decode(int node, float *vector) const
+{
+	const qsizetype row = m_deleted[node] ? -1 : m_store->rowOf(m_labels[node]);
+	if (row < 0)
+		return false;
+	m_store->decode(row, vector);
+	return true;
+}
+
+int *HnswIndex::links(int node, int level)
+{
+	// only written after detach(), when the links are on the heap
+	Q_ASSERT(!m_file);
+	return const_cast<int*>(std::as_const(*this).links(node, level));
+}
+
+const int *HnswIndex::links(int node, int level) const
+{
+	if (level == 0)
+		return m_level0Links + std::size_t(node) * (maxLinks(0) + 1);
+	return m_upperLinks + m_upperOffset[node] + std::size_t(level - 1) * (maxLinks(1) + 1);
+}
+
+void HnswIndex::detach()
+{
+	if (!m_file)
+		return;
+
+	const std::size_t count = m_labels.size();
+	const std::size_t upperSize = count > 0 ? std::size_t(m_upperOffset.back()) + std::size_t(m_levels.back()) * (maxLinks(1) + 1) : 0;
+	m_level0.assign(m_level0Links, m_level0Links + count * (maxLinks(0) + 1));
+	m_upper.assign(m_upperLinks, m_upperLinks + upperSize);
+	m_level0Links = m_level0.data();
+	m_upperLinks = m_upper.data();
+	m_file.reset();
+}
+
+int HnswIndex::greedySearch(const float *query, int entry, int fromLevel, int toLevel) const
+{
+	// Walk down the upper layers, always moving to the closest neighbour
+	int current = entry;
+	float currentSimilarity = similarity(query, current);
+	for (int level = fromLevel; level > toLevel; --level) {
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			const int *neighbors = links(current, level);
+			for (int i = 1; i <= neighbors[0]; ++i) {
+				const float s = similarity(query, neighbors[i]);
+				if (s > currentSimilarity) {
+					currentSimilarity = s;
+					current = neighbors[i];
+					changed = true;
+				}
+			}
+		}
+	}
+	return current;
+}
+
+std::vector<HnswIndex::Candidate> HnswIndex::searchLayer(const float *query, const std::vector<Candidate> &entries,
+														 int ef, int level) const
+{
+	std::vector<bool> visited(m_labels.size(), false);
+	// candidates: best first, results: worst first so the weakest is evicted
+	std::priority_queue<Candidate> candidates;
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> results;
+
+	for (const Candidate &entry : entries) {
+		visited[entry.second] = true;
+		candidates.push(entry);
+		if (!m_deleted[entry.second])
+			results.push(entry);
+	}
+	while (int(results.size()) > ef)
+		results.pop();
+
+	while (!candidates.empty()) {
+		const Candidate current = candidates.top();
+		if (int(results.size()) >= ef && current.first < results.top().first)
+			break;
+		candidates.pop();
+
+		const int *neighbors = links(current.second, level);
+		for (int i = 1; i <= neighbors[0]; ++i) {
+			const int node = neighbors[i];
+			if (visited[node])
+				continue;
+			visited[node] = true;
+
+			// a tombstone is passed through at the similarity it was reached with
+			if (m_deleted[node]) {
+				candidates.push({current.first, node});
+				continue;
+			}
+
+			const float s = similarity(query, node);
+			if (int(results.size()) < ef || s > results.top().first) {
+				candidates.push({s, node});
+				results.push({s, node});
+				if (int(results.size()) > ef)
+					results.pop();
+			}
+		}
+	}
+
+	std::vector<Candidate> found(results.size());
+	for (auto it = found.rbegin(); it != found.rend(); ++it) {
+		*it = results.top();
+		results.pop();
+	}
+	return found;
+}
+
+void HnswIndex::selectNeighbors(std::vector<Candidate> &candidates, int count) const
+{
+	// Keep a candidate only if it is closer to the base point than to every
+	// neighbour already kept, which spreads links across clusters.
+	// Expects candidates ordered best first.
+	if (int(candidates.size()) <= count)
+		return;
+
+	std::vector<float> vector(m_store->stride());
+	std::vector<Candidate> selected;
+	selected.reserve(count);
+	for (const Candidate &candidate : candidates) {
+		if (int(selected.size()) >= count)
+			break;
+		if (!decode(candidate.second, vector.data()))
+			continue;
+
+		bool keep = true;
+		for (const Candidate &other : selected) {
+			if (similarity(vector.data(), other.second) > candidate.first) {
+				keep = false;
+				break;
+			}
+		}
+		if (keep)
+			selected.push_back(candidate);
+	}
+	candidates.swap(selected);
+}
+
+void HnswIndex::connect(int node, const std::vector<Candidate> &neighbors, int level)
+{
+	int *own = links(node, level);
+	own[0] = int(neighbors.size());
+	for (std::size_t i = 0; i < neighbors.size(); ++i)
+		own[i + 1] = neighbors[i].second;
+
+	const int limit = maxLinks(level);
+	std::vector<float> base(m_store->stride());
+	for (const Candidate &neighbor : neighbors) {
+		int *other = links(neighbor.second, level);
+		if (other[0] < limit) {
+			other[++other[0]] = node;
+			continue;
+		}
+
+		// Neighbour is full: re-select its links including the new node,
+		// links to tombstones are dropped on the way
+		if (!decode(neighbor.second, base.data()))
+			continue;
+		std::vector<Candidate> candidates;
+		candidates.reserve(limit + 1);
+		candidates.push_back({neighbor.first, node});
+		for (int i = 1; i <= other[0]; ++i) {
+			if (!m_deleted[other[i]])
+				candidates.push_back({similarity(base.data(), other[i]), other[i]});
+		}
+		std::sort(candidates.begin(), candidates.end(), std::greater<Candidate>());
+		selectNeighbors(candidates, limit);
+
+		other[0] = int(candidates.size());
+		for (std::size_t i = 0; i < candidates.size(); ++i)
+			other[i + 1] = candidates[i].second;
+	}
+}
+
+int HnswIndex::randomLevel()
+{
+	std::uniform_real_distribution<double> distribution(0.0, 1.0);
+	const double r = 1.0 - distribution(m_rng);
+	return int(-std::log(r) * m_levelMultiplier);
+}
@@ -0,0 +1,128 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HNSWINDEX_H
+#define HNSWINDEX_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "TopK.h"
+
+class QFile;
+class VectorStore;
+
+// Hierarchical navigable small world graph for approximate nearest neighbour
+// search over unit length vectors (similarity = dot product). Nodes are
+// addressed by an external label (the embeddings_queue seq_id) and scored
+// against the VectorStore row with that seq_id, the graph holds no vectors
+// of its own. Deletes only tombstone a node: it has no row left to score,
+// but its links keep routing searches and it is never returned.
+//
+// A saved graph is memory mapped by load(), the links are read from the
+// mapping until the first change copies them to the heap.
+//
+// Vectors passed to insert() and search() must be zero padded to the
+// store's stride().
+class HnswIndex
+{
+public:
+	struct Parameters {
+		int M = 16;
+		int efConstruction = 200;
+		int efSearch = 64;
+	};
+
+	HnswIndex() = default;
+	~HnswIndex();
+
+	HnswIndex(const HnswIndex&) = delete;
+	HnswIndex& operator=(const HnswIndex&) = delete;
+
+	// `store` must outlive the index and hold a row for every live label
+	void reset(const VectorStore *store, const Parameters &parameters);
+	void clear();
+
+	inline const Parameters &parameters() const { return m_parameters; }
+	void setEfSearch(int efSearch);
+
+	inline int dimension() const { return m_dimension; }
+	inline qsizetype size() const { return qsizetype(m_labels.size()) - m_deletedCount; }
+	inline qsizetype deletedCount() const { return m_deletedCount; }
+	inline bool contains(int label) const { return m_nodeByLabel.contains(label); }
+	inline bool isMapped() const { return m_file != nullptr; }
+
+	void insert(int label, const float *vector);
+	bool markDeleted(int label);
+	QVector<ScoredId> search(const float *query, int topk) const;
+
+	bool save(const QString &fileName) const;
+	bool load(const QString &fileName, const VectorStore *store);
+
+private:
+	using Candidate = std::pair<float, int>; // similarity, node
+
+	float similarity(const float *query, int node) const;
+	bool decode(int node, float *vector) const;
+	int *links(int node, int level);
+	const int *links(int node, int level) const;
+	inline int maxLinks(int level) const { return level == 0 ? m_parameters.M * 2 : m_parameters.M; }
+	void detach();
+
+	int greedySearch(const float *query, int entry, int fromLevel, int toLevel) const;
+	std::vector<Candidate> searchLayer(const float *query, const std::vector<Candidate> &entries, int ef, int level) const;
+	void selectNeighbors(std::vector<Candidate> &candidates, int count) const;
+	void connect(int node, const std::vector<Candidate> &neighbors, int level);
+	int randomLevel();
+
+	Parameters m_parameters;
+	const VectorStore *m_store = nullptr;
+	int m_dimension = 0;
+	int m_entryPoint = -1;
+	int m_maxLevel = -1;
+	double m_levelMultiplier = 0.0;
+	qsizetype m_deletedCount = 0;
+
+	// Links as count followed by up to maxLinks() nodes: 2*M at level 0, M
+	// per level above it. The pointers refer to the vectors below or, after
+	// load(), to the mapped file.
+	std::vector<int> m_level0;
+	std::vector<int> m_upper;
+	const int *m_level0Links = nullptr;
+	const int *m_upperLinks = nullptr;
+	std::vector<qsizetype> m_upperOffset; // per node: start of its levels in the upper links
+	std::vector<int> m_levels;
+	std::vector<int> m_labels;
+	std::vector<char> m_deleted;
+	QHash<int, int> m_nodeByLabel;
+	std::unique_ptr<QFile> m_file;
+	std::mt19937 m_rng{100};
+};
+
+#endif // HNSWINDEX_H
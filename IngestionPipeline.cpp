@@ -0,0 +1,275 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "IngestionPipeline.h"
+#include "FileManifest.h"
+
+#include <QtPdf/QPdfDocument>
+#include <QFileInfo>
+
+#include <vector>
+
+ChunkQueue::ChunkQueue(int capacity)
+	: m_capacity(qMax(1, capacity))
+{
+}
+
+void ChunkQueue::setCapacity(int capacity)
+{
+	QMutexLocker locker(&m_mutex);
+	m_capacity = qMax(1, capacity);
+	m_notFull.wakeAll();
+}
+
+bool ChunkQueue::push(Chunk &&chunk)
+{
+	QMutexLocker locker(&m_mutex);
+	while (!m_closed && m_chunks.size() >= m_capacity)
+		m_notFull.wait(&m_mutex);
+	if (m_closed)
+		return false;
+	m_chunks.enqueue(std::move(chunk));
+	return true;
+}
+
+std::optional<Chunk> ChunkQueue::tryPop()
+{
+	QMutexLocker locker(&m_mutex);
+	if (m_chunks.isEmpty())
+		return std::nullopt;
+	Chunk chunk = m_chunks.dequeue();
+	m_notFull.wakeOne();
+	return chunk;
+}
+
+bool ChunkQueue::isEmpty() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_chunks.isEmpty();
+}
+
+void ChunkQueue::close()
+{
+	QMutexLocker locker(&m_mutex);
+	m_closed = true;
+	m_chunks.clear();
+	m_notFull.wakeAll();
+}
+
+void ChunkQueue::reopen()
+{
+	QMutexLocker locker(&m_mutex);
+	m_closed = false;
+}
+
+struct IngestionPipeline::FileJob {
+	QString path;
+	QByteArray hash;
+	std::vector<QString> pages; // written by the range tasks, one slot per page
+	std::atomic<int> remainingRanges{0};
+};
+
+IngestionPipeline::IngestionPipeline(QObject *parent)
+	: QObject{parent}
+{
+}
+
+IngestionPipeline::~IngestionPipeline()
+{
+	cancel();
+}
+
+void IngestionPipeline::setChunkOptions(const TextChunker::Options &options)
+{
+	m_chunkOptions = options;
+}
+
+void IngestionPipeline::setPagesPerTask(int pages)
+{
+	m_pagesPerTask = qMax(1, pages);
+}
+
+void IngestionPipeline::setMaxOpenFiles(int files)
+{
+	m_maxOpenFiles = qMax(0, files);
+}
+
+void IngestionPipeline::setMaxQueuedChunks(int chunks)
+{
+	m_queue.setCapacity(chunks);
+}
+
+void IngestionPipeline::start(const QVector<SourceFile> &files)
+{
+	cancel();
+	m_queue.reopen();
+	m_cancelled = false;
+	m_pagesDone = 0;
+	m_pagesTotal = 0;
+	m_chunksQueued = 0;
+	m_pendingFiles = int(files.size());
+
+	if (files.isEmpty()) {
+		emit finished();
+		return;
+	}
+
+	// Files are admitted as others finish, so only a few are held in memory
+	// however many are queued
+	m_files = files;
+	m_nextFile = 0;
+	const int openFiles = m_maxOpenFiles > 0 ? m_maxOpenFiles : m_pool.maxThreadCount();
+	for (int i = 0; i < openFiles; ++i)
+		openNextFile();
+}
+
+void IngestionPipeline::openNextFile()
+{
+	const int index = m_nextFile.fetch_add(1);
+	if (index < m_files.size())
+		m_pool.start([this, index]() { openFile(m_files[index]); });
+}
+
+void IngestionPipeline::cancel()
+{
+	m_cancelled = true;
+	m_queue.close();
+	m_pool.waitForDone();
+}
+
+std::optional<Chunk> IngestionPipeline::takeChunk()
+{
+	return m_queue.tryPop();
+}
+
+void IngestionPipeline::openFile(const SourceFile &file)
+{
+	QPdfDocument pdf;
+	if (m_cancelled || pdf.load(file.path) != QPdfDocument::Error::None) {
+		if (!m_cancelled)
+			emit error("Error loading " + QFileInfo(file.path).fileName());
+		finishFile();
+		return;
+	}
+
+	const int pageCount = pdf.pageCount();
+	emit documentOpened(file.path, pageCount);
+	if (!file.extract) {
+		finishFile();
+		return;
+	}
+
+	m_pagesTotal += pageCount;
+	emit progress(m_pagesDone, m_pagesTotal);
+
+	// The job is shared by the range tasks, the one finishing last chunks it
+	auto job = std::make_shared<FileJob>();
+	job->path = file.path;
+	job->hash = FileManifest::hashFile(file.path);
+	job->pages.resize(pageCount);
+	const int ranges = (pageCount + m_pagesPerTask - 1) / m_pagesPerTask;
+	job->remainingRanges = ranges;
+	if (ranges == 0) {
+		chunkFile(*job);
+		return;
+	}
+
+	// page ranges of open files run before the next file is opened
+	for (int range = 1; range < ranges; ++range) {
+		m_pool.start([this, job, range]() {
+			QPdfDocument pdf;
+			pdf.load(job->path);
+			extractPages(pdf, *job, range);
+		}, 1);
+	}
+	extractPages(pdf, *job, 0);
+}
+
+void IngestionPipeline::extractPages(QPdfDocument &pdf, FileJob &job, int range)
+{
+	const int first = range * m_pagesPerTask;
+	const int last = qMin(first + m_pagesPerTask, int(job.pages.size()));
+	for (int i = first; i < last && !m_cancelled; ++i) {
+		// Parse page
+		job.pages[i] = TextChunker::cleanPage(pdf.getAllText(i).text());
+		emit progress(++m_pagesDone, m_pagesTotal);
+	}
+
+	if (job.remainingRanges.fetch_sub(1) == 1)
+		chunkFile(job);
+}
+
+void IngestionPipeline::chunkFile(FileJob &job)
+{
+	if (m_cancelled) {
+		finishFile();
+		return;
+	}
+
+	const QString fileName = QFileInfo(job.path).fileName();
+	const int pageCount = int(job.pages.size());
+
+	// The pages are joined once, chunks are spans of the joined text
+	qsizetype length = 0;
+	for (const QString &page : job.pages)
+		length += page.size() + 1;
+	QString text;
+	text.reserve(length);
+	QVector<qsizetype> pageEnds;
+	pageEnds.reserve(pageCount);
+	for (QString &page : job.pages) {
+		text += page;
+		if (!page.isEmpty() && !page.back().isSpace())
+			text += '\n';
+		pageEnds.append(text.size());
+		page = QString(); // held only once
+	}
+
+	// Chunk ids are file:page:chunk, with the page the chunk ends on
+	int page = 0;
+	int chunk = 0;
+	TextChunker(m_chunkOptions).split(text, [&](qsizetype begin, qsizetype end, bool last) {
+		int endPage = page;
+		while (endPage + 1 < pageCount && pageEnds[endPage] < end)
+			++endPage;
+		if (endPage != page) {
+			page = endPage;
+			chunk = 0;
+		}
+
+		const QString id = QString("%1:%2:%3").arg(fileName).arg(page + 1).arg(chunk++);
+		if (!m_queue.push({ job.path, id, text.mid(begin, end - begin), last, last ? job.hash : QByteArray() }))
+			return false;
+		++m_chunksQueued;
+		emit chunksAvailable();
+		return true;
+	});
+	finishFile();
+}
+
+void IngestionPipeline::finishFile()
+{
+	openNextFile();
+	if (m_pendingFiles.fetch_sub(1) == 1)
+		emit finished();
+}
@@ -0,0 +1,135 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INGESTIONPIPELINE_H
+#define INGESTIONPIPELINE_H
+
+#include <QObject>
+#include <QMutex>
+#include <QQueue>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <memory>
+#include <optional>
+
+#include "TextChunker.h"
+
+class QPdfDocument;
+
+struct Chunk {
+	QString filePath;
+	QString id;
+	QString text;
+	bool last = false; // last chunk of its file
+	QByteArray fileHash; // content hash of the file, on the last chunk
+};
+
+// Fixed capacity queue between the parser threads and the embedding stage.
+// push() blocks while the queue is full, so parsing never runs further ahead
+// of the embeddings than the capacity allows.
+class ChunkQueue
+{
+public:
+	explicit ChunkQueue(int capacity = 256);
+
+	void setCapacity(int capacity);
+	bool push(Chunk &&chunk);
+	std::optional<Chunk> tryPop();
+	bool isEmpty() const;
+
+	// wakes blocked producers, push() fails until reopen()
+	void close();
+	void reopen();
+
+private:
+	mutable QMutex m_mutex;
+	QWaitCondition m_notFull;
+	QQueue<Chunk> m_chunks;
+	int m_capacity;
+	bool m_closed = false;
+};
+
+// Extracts and chunks PDF files on a thread pool. Each file is opened by its
+// own task and large files are split into page ranges that are extracted in
+// parallel, every task using its own QPdfDocument. The chunks of a file are
+// queued in order once all of its pages are extracted.
+class IngestionPipeline : public QObject
+{
+	Q_OBJECT
+public:
+	struct SourceFile {
+		QString path;
+		bool extract = true; // false only reports the page count
+	};
+
+	explicit IngestionPipeline(QObject *parent = nullptr);
+	~IngestionPipeline();
+
+	void setChunkOptions(const TextChunker::Options &options);
+	void setPagesPerTask(int pages);
+	// 0 opens as many files at once as the pool has threads
+	void setMaxOpenFiles(int files);
+	void setMaxQueuedChunks(int chunks);
+
+	void start(const QVector<SourceFile> &files);
+	void cancel();
+
+	std::optional<Chunk> takeChunk();
+	inline bool hasChunks() const { return !m_queue.isEmpty(); }
+	inline int queuedChunks() const { return m_chunksQueued; }
+	// all files are parsed, chunks might still be queued
+	inline bool isFinished() const { return m_pendingFiles == 0; }
+
+signals:
+	void documentOpened(const QString &filePath, int pageCount);
+	void progress(int pagesDone, int pagesTotal);
+	void chunksAvailable();
+	void finished();
+	void error(const QString &message);
+
+private:
+	struct FileJob;
+
+	void openNextFile();
+	void openFile(const SourceFile &file);
+	void extractPages(QPdfDocument &pdf, FileJob &job, int range);
+	void chunkFile(FileJob &job);
+	void finishFile();
+
+	QThreadPool m_pool;
+	ChunkQueue m_queue;
+	TextChunker::Options m_chunkOptions;
+	QVector<SourceFile> m_files;
+	std::atomic<int> m_nextFile{0};
+	int m_maxOpenFiles = 0;
+	int m_pagesPerTask = 16;
+	std::atomic<bool> m_cancelled{false};
+	std::atomic<int> m_pendingFiles{0};
+	std::atomic<int> m_pagesDone{0};
+	std::atomic<int> m_pagesTotal{0};
+	std::atomic<int> m_chunksQueued{0};
+};
+
+#endif // INGESTIONPIPELINE_H
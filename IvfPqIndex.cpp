@@ -0,0 +1,420 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "IvfPqIndex.h"
+#include "SimilarityKernels.h"
+#include "VectorStore.h"
+
+#include <QFile>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+
+namespace
+{
+
+constexpr quint32 IvfPqMagic = 0x51505649; // "IVPQ"
+constexpr quint32 IvfPqVersion = 1;
+constexpr qsizetype MaxTrainingSamples = 65536;
+
+struct IvfPqFileHeader {
+	quint32 magic;
+	quint32 version;
+	qint32 dimension;
+	qint32 stride;
+	qint32 lists;
+	qint32 subquantizers;
+};
+
+inline int padded(int dimension)
+{
+	return (dimension + 15) / 16 * 16;
+}
+
+void computeBias(const std::vector<float> &centroids, int stride, std::vector<float> &bias)
+{
+	const std::size_t count = centroids.size() / stride;
+	bias.resize(count);
+	for (std::size_t c = 0; c < count; ++c) {
+		const float *centroid = centroids.data() + c * stride;
+		bias[c] = -0.5f * Similarity::dot(centroid, centroid, stride);
+	}
+}
+
+// argmin |x - c|^2 == argmax (x.c - |c|^2/2)
+int nearest(const float *vector, const float *centroids, const float *bias, int stride, int count, float *scores)
+{
+	Similarity::dotBatch(vector, centroids, stride, count, scores);
+	int best = 0;
+	for (int c = 1; c < count; ++c) {
+		if (scores[c] + bias[c] > scores[best] + bias[best])
+			best = c;
+	}
+	return best;
+}
+
+// Lloyd's k-means over `count` rows zero padded to `stride` floats
+std::vector<float> kmeans(const float *data, qsizetype count, int stride, int dimension, int k, int iterations, std::mt19937 &rng)
+{
+	std::vector<float> centroids(std::size_t(k) * stride, 0.0f);
+	std::uniform_int_distribution<qsizetype> pick(0, count - 1);
+
+	std::vector<qsizetype> order(count);
+	std::iota(order.begin(), order.end(), 0);
+	std::shuffle(order.begin(), order.end(), rng);
+	for (int c = 0; c < k; ++c)
+		std::copy_n(data + order[c % count] * stride, stride, centroids.data() + std::size_t(c) * stride);
+
+	std::vector<float> bias, scores(k);
+	std::vector<double> sums(std::size_t(k) * dimension);
+	std::vector<qsizetype> sizes(k);
+	for (int iteration = 0; iteration < iterations; ++iteration) {
+		computeBias(centroids, stride, bias);
+		std::fill(sums.begin(), sums.end(), 0.0);
+		std::fill(sizes.begin(), sizes.end(), 0);
+
+		for (qsizetype i = 0; i < count; ++i) {
+			const float *row = data + i * stride;
+			const int c = nearest(row, centroids.data(), bias.data(), stride, k, scores.data());
+			double *sum = sums.data() + std::size_t(c) * dimension;
+			for (int d = 0; d < dimension; ++d)
+				sum[d] += row[d];
+			++sizes[c];
+		}
+
+		for (int c = 0; c < k; ++c) {
+			float *centroid = centroids.data() + std::size_t(c) * stride;
+			if (sizes[c] == 0) {
+				// reseed empty clusters with a random training row
+				std::copy_n(data + pick(rng) * stride, stride, centroid);
+				continue;
+			}
+			const double *sum = sums.data() + std::size_t(c) * dimension;
+			for (int d = 0; d < dimension; ++d)
+				centroid[d] = float(sum[d] / sizes[c]);
+		}
+	}
+	return centroids;
+}
+
+} // namespace
+
+void IvfPqIndex::clear()
+{
+	m_dimension = 0;
+	m_stride = 0;
+	m_lists = 0;
+	m_subquantizers = 0;
+	m_subdimension = 0;
+	m_substride = 0;
+	m_centroids.clear();
+	m_centroidBias.clear();
+	m_codebooks.clear();
+	m_codebookBias.clear();
+	m_invertedLists.clear();
+	m_listOfLabel.clear();
+}
+
+bool IvfPqIndex::train(const VectorStore &store, const Parameters &parameters)
+{
+	clear();
+	const qsizetype count = store.size();
+	const int dimension = store.dimension();
+	if (count < CodebookSize || dimension <= 0)
+		return false;
+
+	const int stride = padded(dimension);
+	m_parameters = parameters;
+	m_dimension = dimension;
+	m_stride = stride;
+
+	int lists = parameters.lists > 0 ? parameters.lists : int(4.0 * std::sqrt(double(count)));
+	lists = qBound(1, lists, int(count));
+
+	int subquantizers = qBound(1, parameters.subquantizers, dimension);
+	while (dimension % subquantizers != 0)
+		--subquantizers;
+	m_subquantizers = subquantizers;
+	m_subdimension = dimension / subquantizers;
+	m_substride = padded(m_subdimension);
+	m_parameters.lists = lists;
+	m_parameters.subquantizers = subquantizers;
+
+	std::mt19937 rng(1234);
+	const int iterations = qMax(1, parameters.iterations);
+
+	// Random training sample
+	const qsizetype samples = qMin(count, qMin(MaxTrainingSamples,
+			qsizetype(qMax(lists, int(CodebookSize))) * qMax(1, parameters.samplesPerCentroid)));
+	std::vector<qsizetype> order(count);
+	std::iota(order.begin(), order.end(), 0);
+	std::shuffle(order.begin(), order.end(), rng);
+	std::vector<float> training(std::size_t(samples) * stride);
+	std::vector<float> row(store.stride());
+	for (qsizetype i = 0; i < samples; ++i) {
+		store.decode(order[i], row.data());
+		std::copy_n(row.data(), stride, training.data() + i * stride);
+	}
+
+	// Coarse quantizer
+	m_centroids = kmeans(training.data(), samples, stride, dimension, lists, iterations, rng);
+	m_lists = lists;
+	computeBias(m_centroids, m_stride, m_centroidBias);
+
+	std::vector<int> assignment(samples);
+	for (qsizetype i = 0; i < samples; ++i)
+		assignment[i] = nearestList(training.data() + i * stride);
+
+	// One codebook per subspace, trained on the residuals
+	m_codebooks.assign(std::size_t(m_subquantizers) * CodebookSize * m_substride, 0.0f);
+	std::vector<float> residuals(std::size_t(samples) * m_substride, 0.0f);
+	for (int j = 0; j < m_subquantizers; ++j) {
+		const int offset = j * m_subdimension;
+		for (qsizetype i = 0; i < samples; ++i) {
+			const float *row = training.data() + i * stride + offset;
+			const float *centroid = m_centroids.data() + std::size_t(assignment[i]) * stride + offset;
+			float *residual = residuals.data() + i * m_substride;
+			for (int d = 0; d < m_subdimension; ++d)
+				residual[d] = row[d] - centroid[d];
+		}
+		const std::vector<float> codebook = kmeans(residuals.data(), samples, m_substride, m_subdimension, CodebookSize, iterations, rng);
+		std::copy(codebook.begin(), codebook.end(), m_codebooks.begin() + std::size_t(j) * CodebookSize * m_substride);
+	}
+	computeBias(m_codebooks, m_substride, m_codebookBias);
+
+	m_invertedLists.assign(m_lists, {});
+	return true;
+}
+
+void IvfPqIndex::setNprobe(int nprobe)
+{
+	m_parameters.nprobe = qMax(1, nprobe);
+}
+
+void IvfPqIndex::setRerankDepth(int rerankDepth)
+{
+	m_parameters.rerankDepth = qMax(0, rerankDepth);
+}
+
+void IvfPqIndex::add(int label, const float *vector)
+{
+	Q_ASSERT(isTrained());
+	remove(label);
+
+	const int list = nearestList(vector);
+	InvertedList &invertedList = m_invertedLists[list];
+	const std::size_t offset = invertedList.codes.size();
+	invertedList.codes.resize(offset + m_subquantizers);
+	encode(vector, list, invertedList.codes.data() + offset);
+	invertedList.labels.push_back(label);
+	m_listOfLabel.insert(label, list);
+}
+
+bool IvfPqIndex::remove(int label)
+{
+	auto it = m_listOfLabel.find(label);
+	if (it == m_listOfLabel.end())
+		return false;
+
+	InvertedList &invertedList = m_invertedLists[it.value()];
+	m_listOfLabel.erase(it);
+
+	auto position = std::find(invertedList.labels.begin(), invertedList.labels.end(), label);
+	Q_ASSERT(position != invertedList.labels.end());
+	const std::size_t index = std::size_t(position - invertedList.labels.begin());
+	const std::size_t last = invertedList.labels.size() - 1;
+	if (index != last) {
+		invertedList.labels[index] = invertedList.labels[last];
+		std::copy_n(invertedList.codes.data() + last * m_subquantizers, m_subquantizers,
+					invertedList.codes.data() + index * m_subquantizers);
+	}
+	invertedList.labels.pop_back();
+	invertedList.codes.resize(last * m_subquantizers);
+	return true;
+}
+
+void IvfPqIndex::removeAll()
+{
+	for (InvertedList &invertedList : m_invertedLists) {
+		invertedList.labels.clear();
+		invertedList.codes.clear();
+	}
+	m_listOfLabel.clear();
+}
+
+QVector<ScoredId> IvfPqIndex::search(const float *query, int topk) const
+{
+	if (!isTrained() || topk <= 0)
+		return {};
+
+	// Rank lists by distance to their centroid and keep the nprobe closest;
+	// the raw dot product with the centroid is the base score of its entries
+	std::vector<float> coarse(m_lists);
+	Similarity::dotBatch(query, m_centroids.data(), m_stride, m_lists, coarse.data());
+	TopK probes(qMin(m_parameters.nprobe, m_lists));
+	for (int list = 0; list < m_lists; ++list)
+		probes.push(coarse[list] + m_centroidBias[list], list);
+
+	// Lookup table of query . codeword for every subspace
+	std::vector<float> table(std::size_t(m_subquantizers) * CodebookSize);
+	std::vector<float> subquery(m_substride, 0.0f);
+	for (int j = 0; j < m_subquantizers; ++j) {
+		std::copy_n(query + j * m_subdimension, m_subdimension, subquery.begin());
+		Similarity::dotBatch(subquery.data(), m_codebooks.data() + std::size_t(j) * CodebookSize * m_substride,
+							 m_substride, CodebookSize, table.data() + std::size_t(j) * CodebookSize);
+	}
+
+	TopK best(topk);
+	for (const ScoredId &probe : probes.sorted()) {
+		const InvertedList &invertedList = m_invertedLists[probe.seqId];
+		const float base = coarse[probe.seqId];
+		const uint8_t *code = invertedList.codes.data();
+		for (std::size_t i = 0; i < invertedList.labels.size(); ++i, code += m_subquantizers) {
+			float score = base;
+			const float *lookup = table.data();
+			for (int j = 0; j < m_subquantizers; ++j, lookup += CodebookSize)
+				score += lookup[code[j]];
+			if (best.accepts(score))
+				best.push(score, invertedList.labels[i]);
+		}
+	}
+	return best.sorted();
+}
+
+bool IvfPqIndex::save(const QString &fileName) const
+{
+	QSaveFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+
+	auto write = [&file](const void *data, qint64 size) {
+		return file.write(static_cast<const char*>(data), size) == size;
+	};
+
+	IvfPqFileHeader header;
+	header.magic = IvfPqMagic;
+	header.version = IvfPqVersion;
+	header.dimension = m_dimension;
+	header.stride = m_stride;
+	header.lists = m_lists;
+	header.subquantizers = m_subquantizers;
+
+	bool ok = write(&header, sizeof(header))
+			&& write(m_centroids.data(), m_centroids.size() * sizeof(float))
+			&& write(m_codebooks.data(), m_codebooks.size() * sizeof(float));
+	for (const InvertedList &invertedList : m_invertedLists) {
+		if (!ok)
+			break;
+		const qint64 size = qint64(invertedList.labels.size());
+		ok = write(&size, sizeof(size))
+				&& write(invertedList.labels.data(), size * sizeof(int))
+				&& write(invertedList.codes.data(), size * m_subquantizers);
+	}
+	return ok && file.commit();
+}
+
+bool IvfPqIndex::load(const QString &fileName)
+{
+	clear();
+
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	auto read = [&file](void *data, qint64 size) {
+		return file.read(static_cast<char*>(data), size) == size;
+	};
+
+	IvfPqFileHeader header;
+	if (!read(&header, sizeof(header)) || header.magic != IvfPqMagic || header.version != IvfPqVersion
+			|| header.dimension <= 0 || header.stride != padded(header.dimension) || header.lists <= 0
+			|| header.subquantizers <= 0 || header.dimension % header.subquantizers != 0)
+		return false;
+
+	m_dimension = header.dimension;
+	m_stride = header.stride;
+	m_subquantizers = header.subquantizers;
+	m_subdimension = m_dimension / m_subquantizers;
+	m_substride = padded(m_subdimension);
+	m_parameters.lists = header.lists;
+	m_parameters.subquantizers = header.subquantizers;
+
+	m_centroids.resize(std::size_t(header.lists) * m_stride);
+	m_codebooks.resize(std::size_t(m_subquantizers) * CodebookSize * m_substride);
+	bool ok = read(m_centroids.data(), m_centroids.size() * sizeof(float))
+			&& read(m_codebooks.data(), m_codebooks.size() * sizeof(float));
+
+	m_invertedLists.resize(header.lists);
+	for (int list = 0; ok && list < header.lists; ++list) {
+		InvertedList &invertedList = m_invertedLists[list];
+		qint64 size = 0;
+		ok = read(&size, sizeof(size)) && size >= 0;
+		if (!ok)
+			break;
+		invertedList.labels.resize(size);
+		invertedList.codes.resize(size * m_subquantizers);
+		ok = read(invertedList.labels.data(), size * sizeof(int))
+				&& read(invertedList.codes.data(), size * m_subquantizers);
+		for (int label : invertedList.labels)
+			m_listOfLabel.insert(label, list);
+	}
+
+	if (!ok) {
+		clear();
+		return false;
+	}
+
+	m_lists = header.lists;
+	updateBias();
+	return true;
+}
+
+int IvfPqIndex::nearestList(const float *vector) const
+{
+	std::vector<float> scores(m_lists);
+	return nearest(vector, m_centroids.data(), m_centroidBias.data(), m_stride, m_lists, scores.data());
+}
+
+void IvfPqIndex::encode(const float *vector, int list, uint8_t *code) const
+{
+	const float *centroid = m_centroids.data() + std::size_t(list) * m_stride;
+	std::vector<float> residual(m_substride, 0.0f);
+	float scores[CodebookSize];
+	for (int j = 0; j < m_subquantizers; ++j) {
+		const int offset = j * m_subdimension;
+		for (int d = 0; d < m_subdimension; ++d)
+			residual[d] = vector[offset + d] - centroid[offset + d];
+		const std::size_t codebook = std::size_t(j) * CodebookSize;
+		code[j] = uint8_t(nearest(residual.data(), m_codebooks.data() + codebook * m_substride,
+								  m_codebookBias.data() + codebook, m_substride, CodebookSize, scores));
+	}
+}
+
+void IvfPqIndex::updateBias()
+{
+	computeBias(m_centroids, m_stride, m_centroidBias);
+	computeBias(m_codebooks, m_substride, m_codebookBias);
+}
@@ -0,0 +1,108 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef IVFPQINDEX_H
+#define IVFPQINDEX_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include <cstdint>
+#include <vector>
+
+#include "TopK.h"
+
+class VectorStore;
+
+// Inverted file with product quantization for unit length vectors. A coarse
+// k-means quantizer assigns every vector to one of `lists` inverted lists and
+// the residual to its centroid is encoded as `subquantizers` bytes, one
+// 256-entry codebook per subspace. Queries probe the `nprobe` closest lists
+// and score codes with asymmetric distance lookup tables.
+//
+// Vectors passed to add() and search() must be zero padded to a multiple of
+// 16 floats, as in VectorStore.
+class IvfPqIndex
+{
+public:
+	struct Parameters {
+		int lists = 0;            // 0 picks ~4*sqrt(N) at training time
+		int subquantizers = 96;   // bytes per code, rounded down to a divisor of the dimension
+		int nprobe = 16;
+		int rerankDepth = 64;     // candidates rescored with exact vectors, 0 disables
+		int iterations = 10;
+		int samplesPerCentroid = 64;
+	};
+
+	static constexpr int CodebookSize = 256;
+
+	IvfPqIndex() = default;
+
+	void clear();
+	bool train(const VectorStore &store, const Parameters &parameters);
+	inline bool isTrained() const { return m_lists > 0; }
+
+	inline const Parameters &parameters() const { return m_parameters; }
+	void setNprobe(int nprobe);
+	void setRerankDepth(int rerankDepth);
+
+	inline int dimension() const { return m_dimension; }
+	inline qsizetype size() const { return m_listOfLabel.size(); }
+	inline bool contains(int label) const { return m_listOfLabel.contains(label); }
+	inline int codeSize() const { return m_subquantizers; }
+
+	void add(int label, const float *vector);
+	bool remove(int label);
+	void removeAll();
+	QVector<ScoredId> search(const float *query, int topk) const;
+
+	bool save(const QString &fileName) const;
+	bool load(const QString &fileName);
+
+private:
+	struct InvertedList {
+		std::vector<int> labels;
+		std::vector<uint8_t> codes;
+	};
+
+	int nearestList(const float *vector) const;
+	void encode(const float *vector, int list, uint8_t *code) const;
+	void updateBias();
+
+	Parameters m_parameters;
+	int m_dimension = 0;
+	int m_stride = 0;
+	int m_lists = 0;
+	int m_subquantizers = 0;
+	int m_subdimension = 0;
+	int m_substride = 0;
+	std::vector<float> m_centroids;      // m_lists x m_stride
+	std::vector<float> m_centroidBias;   // -|c|^2/2, turns a dot product into an L2 ranking
+	std::vector<float> m_codebooks;      // m_subquantizers x CodebookSize x m_substride
+	std::vector<float> m_codebookBias;
+	std::vector<InvertedList> m_invertedLists;
+	QHash<int, int> m_listOfLabel;
+};
+
+#endif // IVFPQINDEX_H
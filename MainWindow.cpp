@@ -25,16 +25,18 @@
 #include "MainWindow.h"
 #include "./ui_MainWindow.h"
 
-#include <QtPdf/QPdfDocument>
 #include <QThreadPool>
 #include <QMessageBox>
 #include <QTimer>
 #include <QDesktopServices>
+#include <QScrollBar>
+#include <QTextDocumentFragment>
 
 MainWindow::MainWindow(QWidget *parent)
 	: QMainWindow(parent)
 	, m_ui(new Ui::MainWindow)
 	, m_bar(new QProgressBar(this))
+	, m_indexer(m_db, m_client)
 {
 	m_ui->setupUi(this);
 	m_ui->statusbar->addPermanentWidget(m_bar);
@@ -48,6 +50,16 @@ MainWindow::MainWindow(QWidget *parent)
 
 	connect(m_ui->chat, &QTextBrowser::anchorClicked, this, &MainWindow::linkClicked);
 
+	m_renderTimer.setSingleShot(true);
+	m_renderTimer.setInterval(16);
+	connect(&m_renderTimer, &QTimer::timeout, this, &MainWindow::renderPendingTokens);
+
+	// The question is embedded while it is typed, once the user pauses
+	m_speculationTimer.setSingleShot(true);
+	m_speculationTimer.setInterval(300);
+	connect(&m_speculationTimer, &QTimer::timeout, this, &MainWindow::embedSpeculatively);
+	connect(m_ui->editQuestion, &QLineEdit::textEdited, &m_speculationTimer, qOverload<>(&QTimer::start));
+
 	connect(&m_db, &EmbeddingDatabase::error, this, [this](const QString& message) {
 		m_ui->statusbar->showMessage(message);
 		QMessageBox::critical(this, "DB Error", message);
@@ -58,101 +70,50 @@ MainWindow::MainWindow(QWidget *parent)
 		QMessageBox::critical(this, "Ollama Error", message);
 	});
 
+	const IngestionPipeline &pipeline = m_indexer.pipeline();
+	connect(&pipeline, &IngestionPipeline::documentOpened, this, [this](const QString& filePath, int pageCount) {
+		if (QTreeWidgetItem *item = m_documentItems.value(filePath))
+			item->setText(1, QString::number(pageCount));
+	});
+	connect(&pipeline, &IngestionPipeline::progress, this, [this](int pagesDone, int pagesTotal) {
+		m_ui->statusbar->showMessage(QString("Loading documents (%1/%2 pages) ...").arg(pagesDone).arg(pagesTotal));
+	});
+	connect(&pipeline, &IngestionPipeline::error, this, [this](const QString& message) {
+		qWarning() << message;
+		m_ui->statusbar->showMessage(message);
+	});
+
+	connect(&m_indexer, &DocumentIndexer::fileListed, this, [this](const FileFingerprint& file) {
+		auto item = new QTreeWidgetItem({ QFileInfo(file.path).fileName(), file.pages > 0 ? QString::number(file.pages) : QString() });
+		item->setData(0, Qt::UserRole, file.path);
+		m_ui->documents->addTopLevelItem(item);
+		m_documentItems.insert(file.path, item);
+	});
+	connect(&m_indexer, &DocumentIndexer::progress, this, [this](int chunksStored, int chunksTotal) {
+		m_ui->statusbar->showMessage("Generating embeddings ...");
+		m_bar->setMaximum(chunksTotal);
+		m_bar->setValue(chunksStored);
+	});
+	connect(&m_indexer, &DocumentIndexer::finished, this, &MainWindow::finishIngestion);
+
 	m_ui->buttonSend->setEnabled(false);
 	m_ui->editQuestion->setEnabled(false);
 
 	// Load the documents
 	QTimer::singleShot(0, this, [this]() {
-		std::unordered_map<QString,QVector<Document>> documents;
-
 		m_bar->setVisible(true);
 		m_bar->setMaximum(0);
 		m_ui->statusbar->showMessage("Loading documents ...");
 
-		QPdfDocument pdf;
-
 		QDir dir("data");
 		if (!dir.exists()) {
 			dir.mkpath(".");
 			QMessageBox::warning(this, "Warning", "No data directory found. Please add PDF files to the data directory.");
 		}
 
-		int totalChunks = 0;
-		for (const auto& file : dir.entryInfoList(QDir::Files)) {
-			pdf.load(file.absoluteFilePath());
-
-			m_ui->documents->addTopLevelItem(new QTreeWidgetItem({ file.fileName(), QString::number(pdf.pageCount()) }));
-
-			if (m_db.hasCollection(file.absoluteFilePath()))
-				continue;
-
-			QVector<Document> docs;
-
-			// Split the document into chunks with overlap
-			QString text;
-			for (int i = 0; i < pdf.pageCount(); ++i) {
-				// Parse page
-				QString page = pdf.getAllText(i).text();
-				// remove 0xEFBFBE
-				page = page.replace("\xEF\xBF\xBE", "");
-				page = page.replace("\r\n", "\n");
-				page = page.replace(" \n", "\n");
-				Q_ASSERT(!page.contains("\xEF\xBF\xBE"));
-
-				text += page;
-				int chunk = 0;
-
-				int index = -1;
-				while (text.length() > m_minTextChunk) {
-					QString id = QString("%1:%2:%3").arg(file.fileName()).arg(i+1).arg(chunk);
-
-					// Split the text into chunks at whitespace and therefore avoid cutting words in half
-					index = text.indexOf(' ', m_minTextChunk);
-					if (index == -1)
-						break;
-
-					docs.push_back({ id, text.left(index), -1, 0.0 });
-
-					// Split the text at the first whitespace after the min text chunk with overlap
-					index = text.indexOf(' ', m_minTextChunk - m_textOverlap);
-					if (index == -1)
-						index = text.indexOf(' ', m_minTextChunk / 2);
-					Q_ASSERT(index != -1);
-
-					text = text.mid(index + 1);
-					++chunk;
-				}
-
-				qApp->processEvents();
-			}
-
-			// Add the last chunk
-			QString id = QString("%1:%2:%3").arg(file.fileName()).arg(pdf.pageCount()).arg(documents.size());
-			docs.push_back({ id, text, -1, 0.0 });
-
-			totalChunks += docs.size();
-			documents[file.absoluteFilePath()] = docs;
-		}
-
-		m_ui->statusbar->showMessage("Generating embeddings ...");
-
-		if (!documents.empty() && totalChunks > 0) {
-			m_bar->setValue(0);
-			m_bar->setMaximum(totalChunks);
-			for (const auto& document : documents) {
-				for (const Document& doc : document.second) {
-					m_db.addDocument(doc.id, doc.text, m_client.embeddingsBlocking(doc.text));
-					m_bar->setValue(m_bar->value() + 1);
-					qApp->processEvents();
-				}
-				m_db.addCollection(document.first);
-			}
-		}
-
-		m_ui->buttonSend->setEnabled(true);
-		m_ui->editQuestion->setEnabled(true);
-		m_bar->setVisible(false);
-		m_ui->statusbar->showMessage("Ready");
+		m_indexer.setChunkOptions(m_chunkOptions);
+		m_indexer.start(dir);
+		m_ui->documents->sortItems(0, Qt::AscendingOrder);
 	});
 }
 
@@ -165,19 +126,88 @@ void MainWindow::sendPrompt()
 	m_ui->buttonSend->setEnabled(false);
 	m_ui->editQuestion->setEnabled(false);
 
-	QString question = m_ui->editQuestion->text();
+	m_speculationTimer.stop();
+	const QString question = normalizedQuestion(m_ui->editQuestion->text());
 	m_ui->editQuestion->clear();
 
-	m_receivedAnswer += "**Question:** " + question + "\n\n**Answer:** ";
-	m_ui->chat->setMarkdown(m_receivedAnswer);
+	// Only the new turn is converted from markdown and appended
+	m_receivedAnswer.clear();
+	QTextCursor cursor(m_ui->chat->document());
+	cursor.movePosition(QTextCursor::End);
+	insertMarkdown(cursor, "**Question:** " + question + "\n\n**Answer:**");
+	cursor.insertText(" ", QTextCharFormat());
+	m_answerStart = cursor.position();
+	scrollChatToEnd();
+
+	// Usually the embedding was requested while typing and is cached or on
+	// its way, otherwise it is requested now
+	if (const QVector<double> *embedding = m_queryEmbeddings.object(question)) {
+		answerQuestion(question, *embedding);
+		return;
+	}
+	m_question = question;
+	if (m_speculativeText != question)
+		embedQuestion(question);
+}
+
+QString MainWindow::normalizedQuestion(const QString &text)
+{
+	return text.simplified();
+}
 
-	QVector<double> targetEmbedding = m_client.embeddingsBlocking(question);
+void MainWindow::embedSpeculatively()
+{
+	const QString text = normalizedQuestion(m_ui->editQuestion->text());
+	if (text.isEmpty() || text == m_speculativeText || m_queryEmbeddings.contains(text))
+		return;
+	embedQuestion(text);
+}
+
+void MainWindow::embedQuestion(const QString &text)
+{
+	// only the latest text is worth embedding
+	if (m_speculativeRequest != 0)
+		m_client.cancel(m_speculativeRequest);
+
+	m_speculativeText = text;
+	m_speculativeRequest = m_client.embeddings(text, [this, text](const QVector<double> &embedding) {
+		m_speculativeRequest = 0;
+		m_speculativeText.clear();
+		if (!embedding.isEmpty())
+			m_queryEmbeddings.insert(text, new QVector<double>(embedding));
+
+		if (m_question != text)
+			return;
+		m_question.clear();
+		if (embedding.isEmpty()) {
+			m_ui->buttonSend->setEnabled(true);
+			m_ui->editQuestion->setEnabled(true);
+			return;
+		}
+		answerQuestion(text, embedding);
+	});
+}
 
-	const int topk = 5;
+void MainWindow::answerQuestion(const QString &question, const QVector<double> &targetEmbedding)
+{
+	// Documents selected in the tree limit the search to their chunks
+	QStringList scope;
+	for (const QTreeWidgetItem *item : m_ui->documents->selectedItems())
+		scope.append(item->data(0, Qt::UserRole).toString());
+
+	// Retrieval runs on the database's worker threads, the window stays
+	// responsive during large exact scans. The candidates are narrowed to a
+	// diverse context within the token budget.
+	m_db.findDocumentsAsync(targetEmbedding, question, m_contextCandidates, scope, [this, question](const QVector<Document> &candidates) {
+		const ContextPacker packer(m_contextOptions);
+		promptWithContext(question, packer.pack(candidates, m_db.documentVectors(candidates), m_db.vectorStride()));
+	});
+}
 
+void MainWindow::promptWithContext(const QString &question, const QVector<Document> &documents)
+{
 	m_sources.clear();
 	QString context;
-	auto documents = m_db.findDocuments(targetEmbedding, topk);
 	for (const Document& doc : documents) {
 		context += doc.text + "\n\n";
 		QString source = doc.id;
@@ -192,13 +222,31 @@ void MainWindow::sendPrompt()
 
 	m_client.setModel("mistral");
 	QString prompt = m_prompTemplate.arg(context, question);
-	m_client.prompt(prompt);
+	// later turns only see the question, not the context retrieved for it
+	m_client.prompt(prompt, question);
 }
 
 void MainWindow::tokenReceived(const QString &token)
 {
 	m_receivedAnswer += token;
-	m_ui->chat->setMarkdown(m_receivedAnswer);
+	m_pendingTokens += token;
+
+	// tokens are laid out at most once per frame
+	if (!m_renderTimer.isActive())
+		m_renderTimer.start();
+}
+
+void MainWindow::renderPendingTokens()
+{
+	if (m_pendingTokens.isEmpty())
+		return;
+
+	// streamed as plain text to the end of the answer, no re-parsing
+	QTextCursor cursor(m_ui->chat->document());
+	cursor.movePosition(QTextCursor::End);
+	cursor.insertText(m_pendingTokens, QTextCharFormat());
+	m_pendingTokens.clear();
+	scrollChatToEnd();
 }
 
 void MainWindow::finishedPrompt()
@@ -206,9 +254,41 @@ void MainWindow::finishedPrompt()
 	m_ui->buttonSend->setEnabled(true);
 	m_ui->editQuestion->setEnabled(true);
 
+	m_renderTimer.stop();
+	m_pendingTokens.clear();
+
 	m_receivedAnswer += "\n\n**Sources:** " + m_sources.join(", ") + "\n\n";
 
-	m_ui->chat->setMarkdown(m_receivedAnswer);
+	// Replace the streamed plain text of this answer by its markdown once
+	QTextCursor cursor(m_ui->chat->document());
+	cursor.setPosition(m_answerStart);
+	cursor.movePosition(QTextCursor::End, QTextCursor::KeepAnchor);
+	cursor.beginEditBlock();
+	cursor.removeSelectedText();
+	insertMarkdown(cursor, m_receivedAnswer);
+	cursor.endEditBlock();
+	scrollChatToEnd();
+}
+
+void MainWindow::insertMarkdown(QTextCursor &cursor, const QString &markdown)
+{
+	QTextDocument document;
+	document.setMarkdown(markdown);
+	cursor.insertFragment(QTextDocumentFragment(&document));
+}
+
+void MainWindow::scrollChatToEnd()
+{
+	QScrollBar *bar = m_ui->chat->verticalScrollBar();
+	bar->setValue(bar->maximum());
+}
+
+void MainWindow::finishIngestion()
+{
+	m_ui->buttonSend->setEnabled(true);
+	m_ui->editQuestion->setEnabled(true);
+	m_bar->setVisible(false);
+	m_ui->statusbar->showMessage("Ready");
 }
 
 void MainWindow::linkClicked(const QUrl &url)
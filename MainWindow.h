@@ -25,10 +25,17 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QCache>
 #include <QProgressBar>
+#include <QTextCursor>
+#include <QTimer>
 
 #include "OllamaClient.h"
 #include "EmbeddingDatabase.h"
+#include "DocumentIndexer.h"
+#include "ContextPacker.h"
+
+class QTreeWidgetItem;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -46,21 +53,43 @@ private slots:
 	void sendPrompt();
 	void tokenReceived(const QString &token);
 	void finishedPrompt();
+	void renderPendingTokens();
 	void linkClicked(const QUrl &url);
+	void embedSpeculatively();
 
 private:
+	static QString normalizedQuestion(const QString &text);
+	void embedQuestion(const QString &text);
+	static void insertMarkdown(QTextCursor &cursor, const QString &markdown);
+	void scrollChatToEnd();
+	void answerQuestion(const QString &question, const QVector<double> &targetEmbedding);
+	void promptWithContext(const QString &question, const QVector<Document> &documents);
+	void finishIngestion();
+
 	std::unique_ptr<Ui::MainWindow> m_ui;
 	OllamaClient m_client;
 	EmbeddingDatabase m_db;
-	QString m_receivedAnswer;
+	QString m_receivedAnswer; // markdown of the current answer
+	QString m_pendingTokens;
+	QTimer m_renderTimer;
+	// query embeddings by normalized question, least recently used evicted
+	QCache<QString, QVector<double>> m_queryEmbeddings{ 64 };
+	QTimer m_speculationTimer;
+	QString m_speculativeText; // being embedded
+	OllamaClient::RequestId m_speculativeRequest = 0;
+	QString m_question; // sent, waiting for its embedding
+	int m_answerStart = 0;
 	QStringList m_sources;
 	const QString m_prompTemplate = "Answer the question based only on the following context:\n\n%1\n\n---\n\n"
 									"Answer only the question based on the above context and do not start a conversation: %2";
 	QProgressBar *m_bar;
+	DocumentIndexer m_indexer;
+	QHash<QString, QTreeWidgetItem*> m_documentItems;
 
 	// Settings
-	int m_textOverlap = 80;
-	int m_minTextChunk = 800;
+	TextChunker::Options m_chunkOptions; // 200 tokens, 20 overlap, sentence boundaries
+	int m_contextCandidates = 20;
+	ContextPacker::Options m_contextOptions; // 1536 tokens, MMR lambda 0.7
 
 };
 #endif // MAINWINDOW_H
@@ -22,133 +22,385 @@
  */
 
 #include "OllamaClient.h"
+#include "TextChunker.h"
 
 #include <QNetworkRequest>
 #include <QNetworkReply>
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QJsonArray>
-#include <QEventLoop>
+#include <QTimer>
+#include <QDebug>
+
+#include <utility>
 
 // https://github.com/ollama/ollama/blob/main/docs/api.md
 
+namespace
+{
+
+// errors worth another attempt: the server is starting, busy or was too slow
+bool isTransient(QNetworkReply::NetworkError error)
+{
+	switch (error) {
+	case QNetworkReply::ConnectionRefusedError:
+	case QNetworkReply::RemoteHostClosedError:
+	case QNetworkReply::TimeoutError:
+	case QNetworkReply::OperationCanceledError: // transfer timeout
+	case QNetworkReply::TemporaryNetworkFailureError:
+	case QNetworkReply::NetworkSessionFailedError:
+	case QNetworkReply::ProxyTimeoutError:
+	case QNetworkReply::ServiceUnavailableError:
+	case QNetworkReply::UnknownNetworkError:
+		return true;
+	default:
+		return false;
+	}
+}
+
+} // namespace
+
 OllamaClient::OllamaClient(QObject *parent)
 	: QObject{parent}
 {
 	m_manager = new QNetworkAccessManager(this);
+	connectToServer();
 }
 
-void OllamaClient::prompt(const QString &text)
+void OllamaClient::connectToServer()
 {
-	QUrl url("http://localhost:11434/api/generate");
-	//QUrl url("http://localhost:11434/api/chat");
-	QNetworkRequest request(url);
+	// open the connection before the first request needs it, on the port the
+	// requests will use
+	const QUrl url(m_baseUrl);
+	if (url.scheme() == "https") {
+#ifndef QT_NO_SSL
+		m_manager->connectToHostEncrypted(url.host(), quint16(url.port(443)));
+#endif
+	} else {
+		m_manager->connectToHost(url.host(), quint16(url.port(80)));
+	}
+}
 
-	request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+void OllamaClient::prompt(const QString &text, const QString &summary)
+{
+	// An abandoned stream drops its own unanswered turn, before the new one
+	// is added
+	cancelPrompt();
 
-	m_chatHistory += "Prompter:" + text + "\nAI:";
+	QNetworkRequest request = jsonRequest("/api/chat");
 
-	QJsonObject json;
-	json["model"] = m_model;
-
-#if 0
+	// Earlier turns are sent as structured messages, bounded by the history
+	// budget; their retrieved contexts were already replaced by the summary
+	trimHistory();
 	QJsonArray messages;
-	message["role"] = "prompter";
-	message["content"] = text;
-	json["messages"] = message;
-#endif
+	for (const ChatMessage &message : std::as_const(m_history))
+		messages.append(QJsonObject{ { "role", message.role }, { "content", message.content } });
+	messages.append(QJsonObject{ { "role", "user" }, { "content", text } });
+	m_history.append({ "user", summary.isEmpty() ? text : summary });
+	m_answer.clear();
 
-	json["prompt"] = m_chatHistory;
+	QJsonObject json;
+	json["model"] = m_model;
+	json["messages"] = messages;
+	json["keep_alive"] = m_keepAlive;
+	json["options"] = QJsonObject{ { "num_ctx", m_contextTokens } };
 
 	QJsonDocument doc(json);
-	QByteArray data = doc.toJson();
+	QByteArray data = doc.toJson(QJsonDocument::Compact);
 
+	m_promptDone = false;
+	m_streamBuffer.clear();
 	m_reply = m_manager->post(request, data);
 	connect(m_reply, &QNetworkReply::readyRead, this, &OllamaClient::replyReadyRead);
+	connect(m_reply, &QNetworkReply::finished, this, [this, reply = m_reply]() {
+		reply->deleteLater();
+		if (reply != m_reply)
+			return; // cancelled
+
+		// a last line without a trailing newline
+		m_streamBuffer += reply->readAll();
+		processStream(true);
+		if (reply != m_reply)
+			return;
+		m_reply = nullptr;
+		if (reply->error() != QNetworkReply::NoError)
+			emit error("Error in prompt: " + reply->errorString());
+		// let the caller recover from a stream that ended without "done"
+		if (!m_promptDone) {
+			dropUnansweredTurn();
+			emit finishedPrompt();
+		}
+	});
 }
 
-QVector<double> OllamaClient::embeddingsBlocking(const QString &text)
+void OllamaClient::cancelPrompt()
 {
-	QUrl url("http://localhost:11434/api/embeddings");
-	QNetworkRequest request(url);
+	if (!m_reply)
+		return;
+	QNetworkReply *reply = m_reply;
+	m_reply = nullptr;
+	m_streamBuffer.clear();
+	reply->abort();
+	if (!m_promptDone)
+		dropUnansweredTurn();
+}
 
-	request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+void OllamaClient::dropUnansweredTurn()
+{
+	if (!m_history.isEmpty() && m_history.last().role == "user")
+		m_history.removeLast();
+}
 
+OllamaClient::RequestId OllamaClient::embeddings(const QString &text, std::function<void(const QVector<double>&)> callback)
+{
 	QJsonObject json;
-	json["model"] = "nomic-embed-text";
+	json["model"] = m_embeddingModel;
 	json["prompt"] = text;
 	json["stream"] = false;
 
-	QJsonDocument doc(json);
-	QByteArray data = doc.toJson();
-
-	// blocking reply
-	QNetworkAccessManager manager;
-	QNetworkReply *reply = manager.post(request, data);
-	QEventLoop loop;
-	connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
-	loop.exec();
-
-	if (reply->error() != QNetworkReply::NoError) {
-		emit error("Error in embeddingsBlocking: " + reply->errorString());
-		return {};
+	return send("/api/embeddings", json, [callback](const QJsonDocument &responseDoc) {
+		QVector<double> embeddings;
+
+		QJsonArray arr = responseDoc["embedding"].toArray();
+		embeddings.reserve(arr.size());
+
+		for (const QJsonValue &val : arr)
+			embeddings.append(val.toDouble());
+
+		callback(embeddings);
+	});
+}
+
+OllamaClient::RequestId OllamaClient::generate(const QString &text, std::function<void(const QString&)> callback)
+{
+	QJsonObject json;
+	json["model"] = m_model;
+	json["prompt"] = text;
+	json["stream"] = false;
+
+	return send("/api/generate", json, [callback](const QJsonDocument &responseDoc) {
+		callback(responseDoc["response"].toString());
+	});
+}
+
+void OllamaClient::cancel(RequestId id)
+{
+	if (cancelEmbedding(id))
+		return;
+
+	// a pending retry finds no request and does nothing
+	auto it = m_requests.find(id);
+	if (it == m_requests.end())
+		return;
+	QNetworkReply *reply = it->reply;
+	m_requests.erase(it);
+	if (reply)
+		reply->abort();
+}
+
+OllamaClient::RequestId OllamaClient::embed(const QString &id, const QString &text)
+{
+	const RequestId request = m_nextRequestId++;
+	m_embeddingQueue.enqueue({ request, id, text });
+
+	// collect everything queued in this event loop iteration into batches
+	if (!m_dispatchScheduled) {
+		m_dispatchScheduled = true;
+		QTimer::singleShot(0, this, &OllamaClient::dispatchEmbeddings);
 	}
+	return request;
+}
 
-	QByteArray responseData = reply->readAll();
-	QJsonDocument responseDoc = QJsonDocument::fromJson(responseData);
+bool OllamaClient::cancelEmbedding(RequestId id)
+{
+	for (auto it = m_embeddingQueue.begin(); it != m_embeddingQueue.end(); ++it) {
+		if (it->request == id) {
+			m_embeddingQueue.erase(it);
+			return true;
+		}
+	}
 
-	if (responseDoc.object().contains("error")) {
-		emit error(responseDoc["error"].toString());
-		return {};
+	auto it = m_embeddingBatches.find(id);
+	if (it == m_embeddingBatches.end())
+		return false;
+	const RequestId batch = it.value();
+	m_embeddingBatches.erase(it);
+	for (RequestId other : std::as_const(m_embeddingBatches)) {
+		if (other == batch)
+			return true; // the rest of the batch is still wanted
 	}
 
-	QVector<double> embeddings;
+	// an aborted batch never calls back, its slot is free right away
+	if (m_requests.contains(batch)) {
+		cancel(batch);
+		--m_embeddingsInFlight;
+		dispatchEmbeddings();
+	}
+	return true;
+}
 
-	QJsonArray arr = responseDoc["embedding"].toArray();
-	embeddings.reserve(arr.size());
+void OllamaClient::setBaseUrl(const QString &url)
+{
+	const QUrl previous(m_baseUrl);
+	const QUrl next(url);
+	m_baseUrl = url;
+	if (next.scheme() != previous.scheme() || next.host() != previous.host() || next.port() != previous.port())
+		connectToServer();
+}
 
-	for (const QJsonValue &val : arr)
-		embeddings.append(val.toDouble());
+void OllamaClient::setTimeout(int ms)
+{
+	m_timeout = qMax(0, ms);
+}
 
-	return embeddings;
+void OllamaClient::setMaxRetries(int retries)
+{
+	m_maxRetries = qMax(0, retries);
 }
 
-QString OllamaClient::promptBlocking(const QString &text)
+void OllamaClient::setRetryDelay(int ms)
 {
-	QUrl url("http://localhost:11434/api/generate");
-	QNetworkRequest request(url);
+	m_retryDelay = qMax(0, ms);
+}
 
-	request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+void OllamaClient::setEmbeddingModel(const QString &model)
+{
+	m_embeddingModel = model;
+}
 
-	QJsonObject json;
-	json["model"] = m_model;
-	json["prompt"] = text;
-	json["stream"] = false;
+void OllamaClient::setEmbeddingBatchSize(int size)
+{
+	m_embeddingBatchSize = qMax(1, size);
+}
 
-	QJsonDocument doc(json);
-	QByteArray data = doc.toJson();
-
-	// blocking reply
-	QNetworkAccessManager manager;
-	QNetworkReply *reply = manager.post(request, data);
-	QEventLoop loop;
-	connect(reply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
-	loop.exec();
-
-	if (reply->error() != QNetworkReply::NoError) {
-		emit error("Error in promptBlocking: " + reply->errorString());
-		return {};
+void OllamaClient::setMaxEmbeddingRequests(int requests)
+{
+	m_maxEmbeddingRequests = qMax(1, requests);
+}
+
+void OllamaClient::dispatchEmbeddings()
+{
+	m_dispatchScheduled = false;
+	while (!m_embeddingQueue.isEmpty() && m_embeddingsInFlight < m_maxEmbeddingRequests) {
+		QVector<PendingEmbedding> batch;
+		while (!m_embeddingQueue.isEmpty() && batch.size() < m_embeddingBatchSize)
+			batch.append(m_embeddingQueue.dequeue());
+		postEmbeddings(batch);
 	}
+}
+
+void OllamaClient::postEmbeddings(const QVector<PendingEmbedding> &batch)
+{
+	QJsonArray input;
+	for (const PendingEmbedding &pending : batch)
+		input.append(pending.text);
 
-	QByteArray responseData = reply->readAll();
-	QJsonDocument responseDoc = QJsonDocument::fromJson(responseData);
+	QJsonObject json;
+	json["model"] = m_embeddingModel;
+	json["input"] = input;
+
+	++m_embeddingsInFlight;
+	const RequestId request = send("/api/embed", json, [this, batch](const QJsonDocument &responseDoc) {
+		--m_embeddingsInFlight;
+
+		// texts cancelled while the batch was in flight report nothing
+		QVector<bool> wanted(batch.size());
+		for (qsizetype i = 0; i < batch.size(); ++i)
+			wanted[i] = m_embeddingBatches.remove(batch[i].request) > 0;
+
+		const QJsonArray embeddings = responseDoc["embeddings"].toArray();
+		if (responseDoc.isNull() || embeddings.size() != batch.size()) {
+			if (!responseDoc.isNull())
+				emit error(QString("Error in embed: expected %1 embeddings, got %2").arg(batch.size()).arg(embeddings.size()));
+			for (qsizetype i = 0; i < batch.size(); ++i) {
+				if (wanted[i])
+					emit embeddingFailed(batch[i].id);
+			}
+		} else {
+			for (qsizetype i = 0; i < batch.size(); ++i) {
+				if (!wanted[i])
+					continue;
+				const QJsonArray arr = embeddings[i].toArray();
+				QVector<double> embedding;
+				embedding.reserve(arr.size());
+				for (const QJsonValue &val : arr)
+					embedding.append(val.toDouble());
+				emit embeddingReady(batch[i].id, embedding);
+			}
+		}
+
+		dispatchEmbeddings();
+	});
+	for (const PendingEmbedding &pending : batch)
+		m_embeddingBatches.insert(pending.request, request);
+}
+
+QNetworkRequest OllamaClient::jsonRequest(const QString &path) const
+{
+	QNetworkRequest request(QUrl(m_baseUrl + path));
+	request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+	// aborts the reply if no data arrived for this long
+	request.setTransferTimeout(m_timeout);
+	return request;
+}
 
-	if (responseDoc.object().contains("error")) {
-		emit error(responseDoc["error"].toString());
-		return "";
+OllamaClient::RequestId OllamaClient::send(const QString &path, const QJsonObject &json, std::function<void(const QJsonDocument&)> callback)
+{
+	const RequestId id = m_nextRequestId++;
+	Request &request = m_requests[id];
+	request.path = path;
+	request.data = QJsonDocument(json).toJson(QJsonDocument::Compact);
+	request.callback = std::move(callback);
+	startRequest(id);
+	return id;
+}
+
+void OllamaClient::startRequest(RequestId id)
+{
+	auto it = m_requests.find(id);
+	if (it == m_requests.end())
+		return;
+
+	QNetworkReply *reply = m_manager->post(jsonRequest(it->path), it->data);
+	it->reply = reply;
+	connect(reply, &QNetworkReply::finished, this, [this, id, reply]() {
+		requestFinished(id, reply);
+	});
+}
+
+void OllamaClient::requestFinished(RequestId id, QNetworkReply *reply)
+{
+	reply->deleteLater();
+	auto it = m_requests.find(id);
+	if (it == m_requests.end() || it->reply != reply)
+		return; // cancelled
+	it->reply = nullptr;
+
+	const QJsonDocument responseDoc = QJsonDocument::fromJson(reply->readAll());
+	if (reply->error() != QNetworkReply::NoError && isTransient(reply->error()) && it->attempt < m_maxRetries) {
+		const int delay = m_retryDelay << it->attempt;
+		++it->attempt;
+		QTimer::singleShot(delay, this, [this, id]() { startRequest(id); });
+		return;
 	}
 
-	return responseDoc["response"].toString();
+	const auto callback = std::move(it->callback);
+	m_requests.erase(it);
+
+	QString message;
+	if (responseDoc.object().contains("error"))
+		message = responseDoc["error"].toString();
+	else if (reply->error() != QNetworkReply::NoError)
+		message = "Error in " + reply->url().path() + ": " + reply->errorString();
+	else if (responseDoc.isNull())
+		message = "Invalid response from " + reply->url().path();
+
+	if (!message.isEmpty()) {
+		emit error(message);
+		callback({});
+		return;
+	}
+	callback(responseDoc);
 }
 
 void OllamaClient::setModel(const QString &model)
@@ -157,31 +409,94 @@ void OllamaClient::setModel(const QString &model)
 		return;
 
 	m_model = model;
-	m_chatHistory.clear();
+	m_history.clear();
 	emit newSession();
 }
 
 void OllamaClient::clearHistory()
 {
-	m_chatHistory.clear();
+	m_history.clear();
 	emit newSession();
 }
 
-void OllamaClient::replyReadyRead()
+void OllamaClient::setContextTokens(int tokens)
+{
+	m_contextTokens = qMax(512, tokens);
+}
+
+void OllamaClient::setHistoryTokens(int tokens)
+{
+	m_historyTokens = qMax(0, tokens);
+}
+
+void OllamaClient::setKeepAlive(const QString &duration)
+{
+	m_keepAlive = duration;
+}
+
+void OllamaClient::trimHistory()
 {
-	QByteArray responseData = m_reply->readAll();
-	//processResponse(responseData);
+	// the same estimate the retrieved context is packed with, plus the role
+	// and separators of each message
+	auto messageTokens = [](const ChatMessage &message) {
+		return TextChunker::estimateTokens(message.content) + 4;
+	};
+
+	int tokens = 0;
+	for (const ChatMessage &message : std::as_const(m_history))
+		tokens += messageTokens(message);
+
+	// evict whole turns, oldest first, so user and assistant still alternate
+	while (!m_history.isEmpty() && tokens > m_historyTokens) {
+		tokens -= messageTokens(m_history.takeFirst());
+		if (!m_history.isEmpty() && m_history.first().role == "assistant")
+			tokens -= messageTokens(m_history.takeFirst());
+	}
+}
 
-	// parse {...}\n
-	QString response = responseData;
-	int start = response.lastIndexOf('{');
-	int end = response.lastIndexOf('}');
-	if (start == -1 || end == -1 || start >= end) {
+void OllamaClient::replyReadyRead()
+{
+	if (!m_reply)
 		return;
+
+	m_streamBuffer += m_reply->readAll();
+	processStream(false);
+}
+
+void OllamaClient::processStream(bool flush)
+{
+	// The reply is NDJSON, one object per line. Only complete lines are
+	// parsed, a partial one stays in the buffer for the next read.
+	QNetworkReply *reply = m_reply;
+	qsizetype start = 0;
+	while (reply == m_reply && start < m_streamBuffer.size()) {
+		qsizetype end = m_streamBuffer.indexOf('\n', start);
+		if (end == -1) {
+			if (!flush)
+				break;
+			end = m_streamBuffer.size();
+		}
+		const QByteArray line = QByteArray::fromRawData(m_streamBuffer.constData() + start, end - start);
+		start = end + 1;
+		processStreamLine(line);
 	}
 
-	response = response.mid(start, end - start + 1);
-	QJsonDocument doc = QJsonDocument::fromJson(responseData);
+	// a slot may have started a new prompt, which resets the buffer
+	if (reply == m_reply)
+		m_streamBuffer.remove(0, qMin(start, m_streamBuffer.size()));
+}
+
+void OllamaClient::processStreamLine(const QByteArray &line)
+{
+	if (line.trimmed().isEmpty())
+		return;
+
+	QJsonParseError parseError;
+	QJsonDocument doc = QJsonDocument::fromJson(line, &parseError);
+	if (parseError.error != QJsonParseError::NoError) {
+		qWarning() << "Invalid stream line:" << parseError.errorString();
+		return;
+	}
 	QJsonObject obj = doc.object();
 
 	if (obj.contains("error")) {
@@ -190,10 +505,13 @@ void OllamaClient::replyReadyRead()
 	}
 
 	if (obj["done"].toBool()) {
+		m_promptDone = true;
+		m_history.append({ "assistant", m_answer });
 		emit finishedPrompt();
 	} else {
-		QString response = obj["response"].toString();
-		m_chatHistory += response;
+		// /api/chat streams message objects, /api/generate plain responses
+		QString response = obj.contains("message") ? obj["message"]["content"].toString() : obj["response"].toString();
+		m_answer += response;
 		emit tokenReceived(response);
 	}
 }
@@ -26,20 +26,72 @@
 
 #include <QObject>
 #include <QNetworkAccessManager>
+#include <QJsonDocument>
+#include <QQueue>
 
+#include <functional>
+
+// All requests go through the one QNetworkAccessManager, so connections to
+// the server are kept alive between them. Any request, the prompt stream
+// included, is aborted once no data arrived for timeout() ms. Non streaming
+// requests are retried with exponential backoff on transient errors and
+// return an id that can be passed to cancel().
 class OllamaClient : public QObject
 {
 	Q_OBJECT
 public:
+	using RequestId = quint64;
+
 	explicit OllamaClient(QObject *parent = nullptr);
 
-	void prompt(const QString &text);
-	QVector<double> embeddingsBlocking(const QString &text);
-	QString promptBlocking(const QString &text);
+	// Streams the answer to `text` in the current chat session. Only `summary`
+	// (e.g. the bare question without its retrieved context) is kept in the
+	// history for later turns; it defaults to `text`.
+	void prompt(const QString &text, const QString &summary = QString());
+	void cancelPrompt();
+
+	// The callbacks receive an empty result if the request failed, error()
+	// is emitted with the reason; cancelled requests never call back
+	RequestId embeddings(const QString &text, std::function<void(const QVector<double>&)> callback);
+	RequestId generate(const QString &text, std::function<void(const QString&)> callback);
+	void cancel(RequestId id);
+
+	// Queues a text for the batched /api/embed endpoint, the result arrives
+	// as embeddingReady() (or embeddingFailed()) with the same id. A cancelled
+	// text reports nothing, its batch is aborted once no text of it is left.
+	RequestId embed(const QString &id, const QString &text);
+	inline int pendingEmbeddings() const { return int(m_embeddingQueue.size()) + m_embeddingsInFlight; }
+
+	void setBaseUrl(const QString &url);
+	inline QString baseUrl() const { return m_baseUrl; }
+	void setTimeout(int ms);
+	inline int timeout() const { return m_timeout; }
+	void setMaxRetries(int retries);
+	inline int maxRetries() const { return m_maxRetries; }
+	void setRetryDelay(int ms);
+	inline int retryDelay() const { return m_retryDelay; }
+
+	// num_ctx of the model and the share of it older turns may use
+	void setContextTokens(int tokens);
+	inline int contextTokens() const { return m_contextTokens; }
+	void setHistoryTokens(int tokens);
+	inline int historyTokens() const { return m_historyTokens; }
+	// how long the server keeps the model loaded, e.g. "30m"
+	void setKeepAlive(const QString &duration);
+	inline QString keepAlive() const { return m_keepAlive; }
+
+	void setEmbeddingModel(const QString &model);
+	inline QString embeddingModel() const { return m_embeddingModel; }
+	void setEmbeddingBatchSize(int size);
+	inline int embeddingBatchSize() const { return m_embeddingBatchSize; }
+	void setMaxEmbeddingRequests(int requests);
+	inline int maxEmbeddingRequests() const { return m_maxEmbeddingRequests; }
 
 signals:
 	void tokenReceived(const QString &token);
 	void finishedPrompt();
+	void embeddingReady(const QString &id, const QVector<double> &embedding);
+	void embeddingFailed(const QString &id);
 	void newSession();
 
 	void error(const QString& message);
@@ -50,12 +102,66 @@ public slots:
 
 private slots:
 	void replyReadyRead();
+	void dispatchEmbeddings();
 
 private:
+	struct PendingEmbedding {
+		RequestId request;
+		QString id;
+		QString text;
+	};
+
+	struct ChatMessage {
+		QString role;
+		QString content;
+	};
+
+	struct Request {
+		QString path;
+		QByteArray data;
+		std::function<void(const QJsonDocument&)> callback; // null document on failure
+		int attempt = 0;
+		QNetworkReply *reply = nullptr;
+	};
+
+	void trimHistory();
+	void dropUnansweredTurn();
+	void processStream(bool flush);
+	void processStreamLine(const QByteArray &line);
+
+	void connectToServer();
+	QNetworkRequest jsonRequest(const QString &path) const;
+	RequestId send(const QString &path, const QJsonObject &json, std::function<void(const QJsonDocument&)> callback);
+	void startRequest(RequestId id);
+	void requestFinished(RequestId id, QNetworkReply *reply);
+	void postEmbeddings(const QVector<PendingEmbedding> &batch);
+	bool cancelEmbedding(RequestId id);
+
 	QNetworkAccessManager *m_manager;
-	QNetworkReply *m_reply;
+	QNetworkReply *m_reply = nullptr;
+	QByteArray m_streamBuffer;
+	bool m_promptDone = false;
 	QString m_model = "llama3";
-	QString m_chatHistory;
+	QVector<ChatMessage> m_history;
+	QString m_answer;
+	int m_contextTokens = 8192;
+	int m_historyTokens = 2048;
+	QString m_keepAlive = "30m";
+
+	QString m_baseUrl = "http://localhost:11434";
+	int m_timeout = 120000;
+	int m_maxRetries = 3;
+	int m_retryDelay = 500;
+	QHash<RequestId, Request> m_requests;
+	RequestId m_nextRequestId = 1;
+
+	QString m_embeddingModel = "nomic-embed-text";
+	QQueue<PendingEmbedding> m_embeddingQueue;
+	int m_embeddingBatchSize = 32;
+	int m_maxEmbeddingRequests = 4;
+	int m_embeddingsInFlight = 0;
+	QHash<RequestId, RequestId> m_embeddingBatches; // text in flight -> its batch request
+	bool m_dispatchScheduled = false;
 
 };
 
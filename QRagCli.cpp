@@ -0,0 +1,187 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Headless front end to the retrieval core:
+//   qrag ingest <directory>   index the PDF files of a directory
+//   qrag query <question>     print the chunks retrieved for a question
+//   qrag stats                print what the database holds
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QTimer>
+
+#include <optional>
+
+#include "DocumentIndexer.h"
+#include "EmbeddingDatabase.h"
+#include "OllamaClient.h"
+
+static std::optional<EmbeddingDatabase::SearchMode> parseSearchMode(const QString &name)
+{
+	if (name == "exact")
+		return EmbeddingDatabase::SearchMode::Exact;
+	if (name == "hnsw")
+		return EmbeddingDatabase::SearchMode::Hnsw;
+	if (name == "ivfpq")
+		return EmbeddingDatabase::SearchMode::IvfPq;
+	if (name == "binary")
+		return EmbeddingDatabase::SearchMode::Binary;
+	return std::nullopt;
+}
+
+static int ingest(QCoreApplication &app, EmbeddingDatabase &db, OllamaClient &client, const QString &directory)
+{
+	QTextStream out(stdout);
+	QTextStream err(stderr);
+
+	const QDir dir(directory);
+	if (!dir.exists()) {
+		err << "No such directory: " << directory << "\n";
+		return 1;
+	}
+
+	DocumentIndexer indexer(db, client);
+	int files = 0;
+	QObject::connect(&indexer, &DocumentIndexer::fileListed, [&files](const FileFingerprint &) {
+		++files;
+	});
+	QObject::connect(&indexer.pipeline(), &IngestionPipeline::error, [&err](const QString &message) {
+		err << message << "\n";
+		err.flush();
+	});
+	QObject::connect(&indexer, &DocumentIndexer::progress, [&out](int chunksStored, int chunksTotal) {
+		out << "\rEmbedded " << chunksStored << "/" << chunksTotal << " chunks";
+		out.flush();
+	});
+	QObject::connect(&indexer, &DocumentIndexer::finished, &app, &QCoreApplication::quit);
+
+	QTimer::singleShot(0, &indexer, [&indexer, &dir]() {
+		indexer.start(dir);
+	});
+	app.exec();
+
+	out << "\n" << files << " files, " << db.documentCount() << " chunks in " << db.fileName() << "\n";
+	return 0;
+}
+
+static int query(QCoreApplication &app, EmbeddingDatabase &db, OllamaClient &client, const QString &question, int topk, bool hybrid,
+				 const QStringList &collections)
+{
+	QTextStream out(stdout);
+	int result = 1;
+
+	client.embeddings(question, [&](const QVector<double> &embedding) {
+		if (!embedding.isEmpty()) {
+			const QVector<Document> documents = hybrid ? db.findDocumentsHybrid(embedding, question, topk, collections)
+													   : db.findDocuments(embedding, topk, collections);
+			for (const Document &doc : documents) {
+				out << doc.id << "\t" << doc.value << "\n"
+					<< doc.text.simplified().left(240) << "\n\n";
+			}
+			result = 0;
+		}
+		app.quit();
+	});
+	app.exec();
+	return result;
+}
+
+static int stats(EmbeddingDatabase &db)
+{
+	QTextStream out(stdout);
+	out << "database:   " << db.fileName() << "\n"
+		<< "files:      " << db.collections().size() << "\n"
+		<< "chunks:     " << db.documentCount() << "\n"
+		<< "dimension:  " << db.dimension() << "\n"
+		<< "encoding:   " << VectorCodec::name(db.vectorEncoding()) << "\n"
+		<< "resident:   " << VectorCodec::name(db.residentEncoding()) << "\n";
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("qrag");
+	QTextStream err(stderr);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Ingest PDF files and query them without the user interface.");
+	parser.addHelpOption();
+	parser.addPositionalArgument("command", "ingest <directory>, query <question> or stats");
+	const QCommandLineOption databaseOption({ "d", "database" }, "SQLite database file.", "file", "embeddings.db");
+	const QCommandLineOption hostOption("host", "Ollama server.", "url", "http://localhost:11434");
+	const QCommandLineOption modelOption("embedding-model", "Model used for the embeddings.", "name", "nomic-embed-text");
+	const QCommandLineOption modeOption("mode", "Vector search: exact, hnsw, ivfpq or binary.", "mode", "hnsw");
+	const QCommandLineOption topkOption({ "k", "top-k" }, "Number of chunks to retrieve.", "count", "5");
+	const QCommandLineOption vectorOnlyOption("vector-only", "Skip the keyword search and rank by the embeddings only.");
+	const QCommandLineOption collectionOption({ "c", "collection" }, "Only search this PDF file, can be repeated.", "file");
+	parser.addOptions({ databaseOption, hostOption, modelOption, modeOption, topkOption, vectorOnlyOption, collectionOption });
+	parser.process(app);
+
+	const QStringList arguments = parser.positionalArguments();
+	const QString command = arguments.value(0);
+	if (command != "ingest" && command != "query" && command != "stats")
+		parser.showHelp(1);
+
+	const auto mode = parseSearchMode(parser.value(modeOption));
+	if (!mode) {
+		err << "Unknown search mode: " << parser.value(modeOption) << "\n";
+		return 1;
+	}
+
+	// the mode is known before the database opens, so only its index is
+	// loaded or built
+	EmbeddingDatabase db(parser.value(databaseOption), *mode);
+	QObject::connect(&db, &EmbeddingDatabase::error, [&err](const QString &message) {
+		err << "Database error: " << message << "\n";
+		err.flush();
+	});
+
+	OllamaClient client;
+	client.setBaseUrl(parser.value(hostOption));
+	client.setEmbeddingModel(parser.value(modelOption));
+	QObject::connect(&client, &OllamaClient::error, [&err](const QString &message) {
+		err << "Ollama error: " << message << "\n";
+		err.flush();
+	});
+
+	if (command == "ingest") {
+		if (arguments.size() != 2)
+			parser.showHelp(1);
+		return ingest(app, db, client, arguments[1]);
+	}
+	if (command == "query") {
+		if (arguments.size() < 2)
+			parser.showHelp(1);
+		const int topk = qMax(1, parser.value(topkOption).toInt());
+		// collections are named by absolute file path
+		QStringList collections;
+		for (const QString &file : parser.values(collectionOption))
+			collections.append(QFileInfo(file).absoluteFilePath());
+		return query(app, db, client, arguments.mid(1).join(' '), topk, !parser.isSet(vectorOnlyOption), collections);
+	}
+	return stats(db);
+}
@@ -0,0 +1,198 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// End to end retrieval benchmark on a synthetic, clustered corpus: ingest
+// rate into the database, index build time, query latency percentiles and
+// recall@k of the approximate search modes against exact search. Ends with
+// switching the vector encoding, which fails the run if the resident vectors
+// do not follow it.
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QSet>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QVector>
+
+#include <algorithm>
+#include <random>
+
+#include "EmbeddingDatabase.h"
+
+struct Latency {
+	double p50 = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+};
+
+static Latency percentiles(QVector<double> samples)
+{
+	std::sort(samples.begin(), samples.end());
+	auto at = [&samples](double p) {
+		return samples[qMin<qsizetype>(samples.size() - 1, qsizetype(p * samples.size()))];
+	};
+	return { at(0.50), at(0.95), at(0.99) };
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QTextStream out(stdout);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Retrieval benchmark on a synthetic corpus.");
+	parser.addHelpOption();
+	const QCommandLineOption rowsOption("rows", "Number of chunks in the corpus.", "count", "100000");
+	const QCommandLineOption dimensionOption("dimension", "Embedding dimension.", "count", "768");
+	const QCommandLineOption clustersOption("clusters", "Number of topics the chunks are drawn around.", "count", "256");
+	const QCommandLineOption queriesOption("queries", "Number of queries per search mode.", "count", "200");
+	const QCommandLineOption topkOption("top-k", "Number of results per query.", "count", "10");
+	const QCommandLineOption encodingOption("encoding", "Vector encoding: f32, f16 or int8.", "name", "f16");
+	const QCommandLineOption threadsOption("threads", "Threads of the exact scan, 0 uses every core.", "count", "0");
+	parser.addOptions({ rowsOption, dimensionOption, clustersOption, queriesOption, topkOption, encodingOption, threadsOption });
+	parser.process(app);
+
+	const int rows = qMax(1, parser.value(rowsOption).toInt());
+	const int dimension = qMax(1, parser.value(dimensionOption).toInt());
+	const int clusters = qMax(1, parser.value(clustersOption).toInt());
+	const int queries = qMax(1, parser.value(queriesOption).toInt());
+	const int topk = qMax(1, parser.value(topkOption).toInt());
+
+	const auto encoding = VectorCodec::fromName(parser.value(encodingOption));
+	if (!encoding || *encoding == VectorEncoding::Float64) {
+		out << "Unknown encoding: " << parser.value(encodingOption) << "\n";
+		return 1;
+	}
+
+	// Chunks scatter around a few topic centers, like real embeddings do, so
+	// the approximate indexes have structure to exploit
+	QRandomGenerator rng(42);
+	std::normal_distribution<double> normal(0.0, 1.0);
+	QVector<QVector<double>> centers(clusters, QVector<double>(dimension));
+	for (QVector<double> &center : centers) {
+		for (double &x : center)
+			x = normal(rng);
+	}
+	auto sample = [&]() {
+		const QVector<double> &center = centers[rng.bounded(clusters)];
+		QVector<double> v(dimension);
+		for (int i = 0; i < dimension; ++i)
+			v[i] = center[i] + 0.5 * normal(rng);
+		return v;
+	};
+
+	QTemporaryDir dir;
+	// no index is maintained during the timed ingest, each is built when
+	// its mode is measured
+	EmbeddingDatabase db(dir.filePath("benchmark.db"), EmbeddingDatabase::SearchMode::Exact);
+	QObject::connect(&db, &EmbeddingDatabase::error, [&out](const QString &message) {
+		out << "Database error: " << message << "\n";
+	});
+	db.setVectorEncoding(*encoding);
+	if (parser.value(threadsOption).toInt() > 0)
+		db.setSearchThreads(parser.value(threadsOption).toInt());
+
+	out << "rows: " << rows << ", dimension: " << dimension << ", clusters: " << clusters
+		<< ", encoding: " << VectorCodec::name(*encoding) << ", search threads: " << db.searchThreads() << "\n";
+
+	QElapsedTimer timer;
+	timer.start();
+	const int batchSize = 1000;
+	for (int begin = 0; begin < rows; begin += batchSize) {
+		db.beginBatch();
+		for (int i = begin; i < qMin(rows, begin + batchSize); ++i)
+			db.addDocument(QString("synthetic.pdf:%1:0").arg(i), QString("synthetic chunk %1").arg(i), sample(), "synthetic.pdf");
+		db.commitBatch();
+	}
+	const double ingestSeconds = timer.nsecsElapsed() / 1e9;
+	out << "ingest: " << ingestSeconds << " s, " << rows / ingestSeconds << " chunks/s\n";
+
+	QVector<QVector<double>> queryVectors(queries);
+	for (QVector<double> &query : queryVectors)
+		query = sample();
+
+	QVector<QSet<int>> truth(queries);
+	for (EmbeddingDatabase::SearchMode mode : { EmbeddingDatabase::SearchMode::Exact, EmbeddingDatabase::SearchMode::Hnsw,
+												EmbeddingDatabase::SearchMode::IvfPq, EmbeddingDatabase::SearchMode::Binary }) {
+		timer.restart();
+		db.setSearchMode(mode);
+		const double buildMs = timer.nsecsElapsed() / 1e6;
+
+		QVector<double> latencies(queries);
+		double recall = 0.0;
+		for (int q = 0; q < queries; ++q) {
+			timer.restart();
+			const QVector<Document> documents = db.findDocuments(queryVectors[q], topk);
+			latencies[q] = timer.nsecsElapsed() / 1e6;
+
+			if (mode == EmbeddingDatabase::SearchMode::Exact) {
+				for (const Document &doc : documents)
+					truth[q].insert(doc.index);
+				continue;
+			}
+			int found = 0;
+			for (const Document &doc : documents)
+				found += truth[q].contains(doc.index) ? 1 : 0;
+			recall += double(found) / qMax<qsizetype>(1, truth[q].size());
+		}
+
+		static const char *names[] = { "exact", "hnsw", "ivfpq", "binary" };
+		const Latency latency = percentiles(latencies);
+		out << names[int(mode)] << ": build " << buildMs << " ms, latency p50 " << latency.p50 << " ms, p95 "
+			<< latency.p95 << " ms, p99 " << latency.p99 << " ms";
+		if (mode != EmbeddingDatabase::SearchMode::Exact)
+			out << ", recall@" << topk << " " << recall / queries;
+		out << "\n";
+	}
+
+	// Switching the encoding must reload the resident vectors in it, exact
+	// search on them is compared against the results of the first encoding
+	db.setSearchMode(EmbeddingDatabase::SearchMode::Exact);
+	int failures = 0;
+	for (VectorEncoding switched : { VectorEncoding::Float32, VectorEncoding::Float16, VectorEncoding::Int8 }) {
+		timer.restart();
+		db.setVectorEncoding(switched);
+		const double reloadMs = timer.nsecsElapsed() / 1e6;
+
+		bool complete = db.residentEncoding() == switched && db.documentCount() == rows;
+		double recall = 0.0;
+		for (int q = 0; q < queries; ++q) {
+			const QVector<Document> documents = db.findDocuments(queryVectors[q], topk);
+			complete = complete && documents.size() == qMin(topk, rows);
+			int found = 0;
+			for (const Document &doc : documents)
+				found += truth[q].contains(doc.index) ? 1 : 0;
+			recall += double(found) / qMax<qsizetype>(1, truth[q].size());
+		}
+
+		out << "switch to " << VectorCodec::name(switched) << ": reload " << reloadMs << " ms, resident "
+			<< VectorCodec::name(db.residentEncoding()) << ", " << db.documentCount() << " rows, recall@" << topk
+			<< " against " << VectorCodec::name(*encoding) << " " << recall / queries << (complete ? "" : " FAILED") << "\n";
+		if (!complete)
+			++failures;
+	}
+
+	return failures > 0 ? 1 : 0;
+}
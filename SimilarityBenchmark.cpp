@@ -0,0 +1,122 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Compares the original double-precision cosine loop against the normalized
+// batch kernels (float32, float16 and int8 rows) for nomic-embed-text sized
+// (768-d) embeddings.
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <QVector>
+
+#include <algorithm>
+#include <cmath>
+
+#include "SimilarityKernels.h"
+#include "VectorStore.h"
+
+static double calculateSimilarity(const QVector<double> &embedding1, const QVector<double> &embedding2)
+{
+	double dotProduct = 0.0;
+	for (int i = 0; i < embedding1.size(); ++i) {
+		dotProduct += embedding1[i] * embedding2[i];
+	}
+
+	double magnitude1 = 0.0, magnitude2 = 0.0;
+	for (int i = 0; i < embedding1.size(); ++i) {
+		magnitude1 += embedding1[i] * embedding1[i];
+		magnitude2 += embedding2[i] * embedding2[i];
+	}
+	magnitude1 = std::sqrt(magnitude1);
+	magnitude2 = std::sqrt(magnitude2);
+
+	return dotProduct / (magnitude1 * magnitude2);
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QTextStream out(stdout);
+
+	const int dimension = 768;
+	const int rows = argc > 1 ? QString(argv[1]).toInt() : 100000;
+	const int repeats = argc > 2 ? QString(argv[2]).toInt() : 10;
+
+	QRandomGenerator rng(42);
+	auto randomVector = [&rng, dimension]() {
+		QVector<double> v(dimension);
+		for (double &x : v)
+			x = rng.generateDouble() * 2.0 - 1.0;
+		return v;
+	};
+
+	QVector<QVector<double>> corpus(rows);
+	for (int i = 0; i < rows; ++i)
+		corpus[i] = randomVector();
+
+	const QVector<double> query = randomVector();
+	QVector<double> reference(rows);
+	QElapsedTimer timer;
+
+	timer.start();
+	for (int r = 0; r < repeats; ++r) {
+		for (int i = 0; i < rows; ++i)
+			reference[i] = calculateSimilarity(query, corpus[i]);
+	}
+	const double scalarMs = timer.nsecsElapsed() / 1e6 / repeats;
+
+	out << "rows: " << rows << ", dimension: " << dimension << ", kernel: " << Similarity::kernelName() << "\n";
+	out << "double loop: " << scalarMs << " ms/query\n";
+
+	for (VectorEncoding encoding : { VectorEncoding::Float32, VectorEncoding::Float16, VectorEncoding::Int8 }) {
+		VectorStore store;
+		store.reset(dimension, encoding);
+		store.reserve(rows);
+		QVector<float> buffer(dimension);
+		for (int i = 0; i < rows; ++i) {
+			std::copy(corpus[i].begin(), corpus[i].end(), buffer.begin());
+			store.append(i, QString::number(i), buffer.constData());
+		}
+
+		QVector<float> target(store.stride(), 0.0f);
+		std::copy(query.begin(), query.end(), target.begin());
+		Similarity::normalize(target.data(), dimension);
+
+		QVector<float> scores(rows);
+		timer.restart();
+		for (int r = 0; r < repeats; ++r)
+			store.scoreBatch(target.constData(), 0, rows, scores.data());
+		const double kernelMs = timer.nsecsElapsed() / 1e6 / repeats;
+
+		double maxError = 0.0;
+		for (int i = 0; i < rows; ++i)
+			maxError = qMax(maxError, std::abs(reference[i] - scores[i]));
+
+		out << VectorCodec::name(encoding) << " kernel: " << kernelMs << " ms/query (" << scalarMs / kernelMs
+			<< "x), max abs error: " << maxError << "\n";
+	}
+
+	return 0;
+}
@@ -0,0 +1,624 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "SimilarityKernels.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMILARITY_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define SIMILARITY_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMILARITY_TARGET(features) __attribute__((target(features)))
+#else
+#define SIMILARITY_TARGET(features)
+#endif
+
+namespace
+{
+
+struct Kernels
+{
+	const char *name;
+	float (*dot)(const float*, const float*, std::size_t);
+	void (*dotBatch)(const float*, const float*, std::size_t, std::size_t, float*);
+	void (*dotBatchF16)(const float*, const std::uint16_t*, std::size_t, std::size_t, float*);
+	void (*dotBatchI8)(const float*, const std::int8_t*, std::size_t, std::size_t, float*);
+	void (*hammingBatch)(const std::uint64_t*, const std::uint64_t*, std::size_t, std::size_t, std::uint32_t*);
+};
+
+inline int popcount64(std::uint64_t x)
+{
+#if defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64)
+	return int(__popcnt64(x));
+#elif defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(x);
+#else
+	x = x - ((x >> 1) & 0x5555555555555555ull);
+	x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+	return int((x * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+float dotScalar(const float *a, const float *b, std::size_t n)
+{
+	float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+	std::size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		s0 += a[i] * b[i];
+		s1 += a[i + 1] * b[i + 1];
+		s2 += a[i + 2] * b[i + 2];
+		s3 += a[i + 3] * b[i + 3];
+	}
+	for (; i < n; ++i)
+		s0 += a[i] * b[i];
+	return (s0 + s1) + (s2 + s3);
+}
+
+[[maybe_unused]] void dotBatchScalar(const float *query, const float *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	for (std::size_t r = 0; r < count; ++r)
+		scores[r] = dotScalar(query, rows + r * stride, stride);
+}
+
+[[maybe_unused]] void dotBatchF16Scalar(const float *query, const std::uint16_t *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	for (std::size_t r = 0; r < count; ++r) {
+		const std::uint16_t *row = rows + r * stride;
+		float sum = 0.0f;
+		for (std::size_t i = 0; i < stride; ++i)
+			sum += query[i] * Similarity::fromHalf(row[i]);
+		scores[r] = sum;
+	}
+}
+
+[[maybe_unused]] void dotBatchI8Scalar(const float *query, const std::int8_t *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	for (std::size_t r = 0; r < count; ++r) {
+		const std::int8_t *row = rows + r * stride;
+		float sum = 0.0f;
+		for (std::size_t i = 0; i < stride; ++i)
+			sum += query[i] * float(row[i]);
+		scores[r] = sum;
+	}
+}
+
+[[maybe_unused]] void hammingBatchScalar(const std::uint64_t *query, const std::uint64_t *codes, std::size_t words, std::size_t count, std::uint32_t *distances)
+{
+	for (std::size_t r = 0; r < count; ++r) {
+		const std::uint64_t *code = codes + r * words;
+		int distance = 0;
+		for (std::size_t w = 0; w < words; ++w)
+			distance += popcount64(query[w] ^ code[w]);
+		distances[r] = std::uint32_t(distance);
+	}
+}
+
+#ifdef SIMILARITY_X86
+
+// Same loop, compiled so the builtin lowers to the popcnt instruction
+SIMILARITY_TARGET("popcnt") void hammingBatchPopcnt(const std::uint64_t *query, const std::uint64_t *codes, std::size_t words, std::size_t count, std::uint32_t *distances)
+{
+	for (std::size_t r = 0; r < count; ++r) {
+		const std::uint64_t *code = codes + r * words;
+		int distance = 0;
+		for (std::size_t w = 0; w < words; ++w)
+			distance += popcount64(query[w] ^ code[w]);
+		distances[r] = std::uint32_t(distance);
+	}
+}
+
+SIMILARITY_TARGET("sse2") inline float hsum128(__m128 v)
+{
+	__m128 shuf = _mm_movehl_ps(v, v);
+	v = _mm_add_ps(v, shuf);
+	shuf = _mm_shuffle_ps(v, v, 0x55);
+	v = _mm_add_ss(v, shuf);
+	return _mm_cvtss_f32(v);
+}
+
+SIMILARITY_TARGET("sse2") float dotSse(const float *a, const float *b, std::size_t n)
+{
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	float sum = hsum128(_mm_add_ps(acc0, acc1));
+	for (; i < n; ++i)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+SIMILARITY_TARGET("sse2") void dotBatchSse(const float *query, const float *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	std::size_t r = 0;
+	for (; r + 4 <= count; r += 4) {
+		const float *r0 = rows + r * stride;
+		const float *r1 = r0 + stride;
+		const float *r2 = r1 + stride;
+		const float *r3 = r2 + stride;
+		__m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+		for (std::size_t i = 0; i < stride; i += 4) {
+			const __m128 q = _mm_loadu_ps(query + i);
+			a0 = _mm_add_ps(a0, _mm_mul_ps(q, _mm_loadu_ps(r0 + i)));
+			a1 = _mm_add_ps(a1, _mm_mul_ps(q, _mm_loadu_ps(r1 + i)));
+			a2 = _mm_add_ps(a2, _mm_mul_ps(q, _mm_loadu_ps(r2 + i)));
+			a3 = _mm_add_ps(a3, _mm_mul_ps(q, _mm_loadu_ps(r3 + i)));
+		}
+		scores[r] = hsum128(a0);
+		scores[r + 1] = hsum128(a1);
+		scores[r + 2] = hsum128(a2);
+		scores[r + 3] = hsum128(a3);
+	}
+	for (; r < count; ++r)
+		scores[r] = dotSse(query, rows + r * stride, stride);
+}
+
+SIMILARITY_TARGET("avx2,fma") inline float hsum256(__m256 v)
+{
+	__m128 lo = _mm256_castps256_ps128(v);
+	const __m128 hi = _mm256_extractf128_ps(v, 1);
+	lo = _mm_add_ps(lo, hi);
+	__m128 shuf = _mm_movehl_ps(lo, lo);
+	lo = _mm_add_ps(lo, shuf);
+	shuf = _mm_shuffle_ps(lo, lo, 0x55);
+	lo = _mm_add_ss(lo, shuf);
+	return _mm_cvtss_f32(lo);
+}
+
+SIMILARITY_TARGET("avx2,fma") float dotAvx2(const float *a, const float *b, std::size_t n)
+{
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+	std::size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+		acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+	}
+	for (; i + 8 <= n; i += 8)
+		acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+	float sum = hsum256(_mm256_add_ps(acc0, acc1));
+	for (; i < n; ++i)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+// Four rows per pass with two accumulators each: eight independent FMA chains
+// share every query load.
+SIMILARITY_TARGET("avx2,fma") void dotBatchAvx2(const float *query, const float *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	std::size_t r = 0;
+	for (; r + 4 <= count; r += 4) {
+		const float *r0 = rows + r * stride;
+		const float *r1 = r0 + stride;
+		const float *r2 = r1 + stride;
+		const float *r3 = r2 + stride;
+		__m256 a0 = _mm256_setzero_ps(), b0 = _mm256_setzero_ps();
+		__m256 a1 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps();
+		__m256 a2 = _mm256_setzero_ps(), b2 = _mm256_setzero_ps();
+		__m256 a3 = _mm256_setzero_ps(), b3 = _mm256_setzero_ps();
+		for (std::size_t i = 0; i < stride; i += 16) {
+			const __m256 qa = _mm256_loadu_ps(query + i);
+			const __m256 qb = _mm256_loadu_ps(query + i + 8);
+			a0 = _mm256_fmadd_ps(qa, _mm256_loadu_ps(r0 + i), a0);
+			b0 = _mm256_fmadd_ps(qb, _mm256_loadu_ps(r0 + i + 8), b0);
+			a1 = _mm256_fmadd_ps(qa, _mm256_loadu_ps(r1 + i), a1);
+			b1 = _mm256_fmadd_ps(qb, _mm256_loadu_ps(r1 + i + 8), b1);
+			a2 = _mm256_fmadd_ps(qa, _mm256_loadu_ps(r2 + i), a2);
+			b2 = _mm256_fmadd_ps(qb, _mm256_loadu_ps(r2 + i + 8), b2);
+			a3 = _mm256_fmadd_ps(qa, _mm256_loadu_ps(r3 + i), a3);
+			b3 = _mm256_fmadd_ps(qb, _mm256_loadu_ps(r3 + i + 8), b3);
+		}
+		scores[r] = hsum256(_mm256_add_ps(a0, b0));
+		scores[r + 1] = hsum256(_mm256_add_ps(a1, b1));
+		scores[r + 2] = hsum256(_mm256_add_ps(a2, b2));
+		scores[r + 3] = hsum256(_mm256_add_ps(a3, b3));
+	}
+	for (; r < count; ++r)
+		scores[r] = dotAvx2(query, rows + r * stride, stride);
+}
+
+SIMILARITY_TARGET("avx2,fma,f16c") void dotBatchF16Avx2(const float *query, const std::uint16_t *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	std::size_t r = 0;
+	for (; r + 4 <= count; r += 4) {
+		const std::uint16_t *r0 = rows + r * stride;
+		const std::uint16_t *r1 = r0 + stride;
+		const std::uint16_t *r2 = r1 + stride;
+		const std::uint16_t *r3 = r2 + stride;
+		__m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+		for (std::size_t i = 0; i < stride; i += 8) {
+			const __m256 q = _mm256_loadu_ps(query + i);
+			a0 = _mm256_fmadd_ps(q, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + i))), a0);
+			a1 = _mm256_fmadd_ps(q, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + i))), a1);
+			a2 = _mm256_fmadd_ps(q, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r2 + i))), a2);
+			a3 = _mm256_fmadd_ps(q, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r3 + i))), a3);
+		}
+		scores[r] = hsum256(a0);
+		scores[r + 1] = hsum256(a1);
+		scores[r + 2] = hsum256(a2);
+		scores[r + 3] = hsum256(a3);
+	}
+	for (; r < count; ++r) {
+		const std::uint16_t *row = rows + r * stride;
+		__m256 acc = _mm256_setzero_ps();
+		for (std::size_t i = 0; i < stride; i += 8)
+			acc = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i))), acc);
+		scores[r] = hsum256(acc);
+	}
+}
+
+SIMILARITY_TARGET("avx2,fma") inline __m256 loadI8Avx2(const std::int8_t *p)
+{
+	return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+}
+
+SIMILARITY_TARGET("avx2,fma") void dotBatchI8Avx2(const float *query, const std::int8_t *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	std::size_t r = 0;
+	for (; r + 4 <= count; r += 4) {
+		const std::int8_t *r0 = rows + r * stride;
+		const std::int8_t *r1 = r0 + stride;
+		const std::int8_t *r2 = r1 + stride;
+		const std::int8_t *r3 = r2 + stride;
+		__m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+		for (std::size_t i = 0; i < stride; i += 8) {
+			const __m256 q = _mm256_loadu_ps(query + i);
+			a0 = _mm256_fmadd_ps(q, loadI8Avx2(r0 + i), a0);
+			a1 = _mm256_fmadd_ps(q, loadI8Avx2(r1 + i), a1);
+			a2 = _mm256_fmadd_ps(q, loadI8Avx2(r2 + i), a2);
+			a3 = _mm256_fmadd_ps(q, loadI8Avx2(r3 + i), a3);
+		}
+		scores[r] = hsum256(a0);
+		scores[r + 1] = hsum256(a1);
+		scores[r + 2] = hsum256(a2);
+		scores[r + 3] = hsum256(a3);
+	}
+	for (; r < count; ++r) {
+		const std::int8_t *row = rows + r * stride;
+		__m256 acc = _mm256_setzero_ps();
+		for (std::size_t i = 0; i < stride; i += 8)
+			acc = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), loadI8Avx2(row + i), acc);
+		scores[r] = hsum256(acc);
+	}
+}
+
+SIMILARITY_TARGET("avx512f") float dotAvx512(const float *a, const float *b, std::size_t n)
+{
+	__m512 acc = _mm512_setzero_ps();
+	std::size_t i = 0;
+	for (; i + 16 <= n; i += 16)
+		acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc);
+	float sum = _mm512_reduce_add_ps(acc);
+	for (; i < n; ++i)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+SIMILARITY_TARGET("avx512f") void dotBatchAvx512(const float *query, const float *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	std::size_t r = 0;
+	for (; r + 8 <= count; r += 8) {
+		const float *row = rows + r * stride;
+		__m512 acc[8];
+		for (int k = 0; k < 8; ++k)
+			acc[k] = _mm512_setzero_ps();
+		for (std::size_t i = 0; i < stride; i += 16) {
+			const __m512 q = _mm512_loadu_ps(query + i);
+			for (int k = 0; k < 8; ++k)
+				acc[k] = _mm512_fmadd_ps(q, _mm512_loadu_ps(row + k * stride + i), acc[k]);
+		}
+		for (int k = 0; k < 8; ++k)
+			scores[r + k] = _mm512_reduce_add_ps(acc[k]);
+	}
+	for (; r < count; ++r)
+		scores[r] = dotAvx512(query, rows + r * stride, stride);
+}
+
+SIMILARITY_TARGET("avx512f") void dotBatchF16Avx512(const float *query, const std::uint16_t *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	std::size_t r = 0;
+	for (; r + 4 <= count; r += 4) {
+		const std::uint16_t *row = rows + r * stride;
+		__m512 acc[4];
+		for (int k = 0; k < 4; ++k)
+			acc[k] = _mm512_setzero_ps();
+		for (std::size_t i = 0; i < stride; i += 16) {
+			const __m512 q = _mm512_loadu_ps(query + i);
+			for (int k = 0; k < 4; ++k)
+				acc[k] = _mm512_fmadd_ps(q, _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + k * stride + i))), acc[k]);
+		}
+		for (int k = 0; k < 4; ++k)
+			scores[r + k] = _mm512_reduce_add_ps(acc[k]);
+	}
+	for (; r < count; ++r) {
+		const std::uint16_t *row = rows + r * stride;
+		__m512 acc = _mm512_setzero_ps();
+		for (std::size_t i = 0; i < stride; i += 16)
+			acc = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i))), acc);
+		scores[r] = _mm512_reduce_add_ps(acc);
+	}
+}
+
+SIMILARITY_TARGET("avx512f") inline __m512 loadI8Avx512(const std::int8_t *p)
+{
+	return _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+}
+
+SIMILARITY_TARGET("avx512f") void dotBatchI8Avx512(const float *query, const std::int8_t *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	std::size_t r = 0;
+	for (; r + 4 <= count; r += 4) {
+		const std::int8_t *row = rows + r * stride;
+		__m512 acc[4];
+		for (int k = 0; k < 4; ++k)
+			acc[k] = _mm512_setzero_ps();
+		for (std::size_t i = 0; i < stride; i += 16) {
+			const __m512 q = _mm512_loadu_ps(query + i);
+			for (int k = 0; k < 4; ++k)
+				acc[k] = _mm512_fmadd_ps(q, loadI8Avx512(row + k * stride + i), acc[k]);
+		}
+		for (int k = 0; k < 4; ++k)
+			scores[r + k] = _mm512_reduce_add_ps(acc[k]);
+	}
+	for (; r < count; ++r) {
+		const std::int8_t *row = rows + r * stride;
+		__m512 acc = _mm512_setzero_ps();
+		for (std::size_t i = 0; i < stride; i += 16)
+			acc = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), loadI8Avx512(row + i), acc);
+		scores[r] = _mm512_reduce_add_ps(acc);
+	}
+}
+
+bool cpuHasAvx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool fma = (info[2] & (1 << 12)) != 0;
+	const bool f16c = (info[2] & (1 << 29)) != 0;
+	if (!osxsave || !fma || !f16c || (_xgetbv(0) & 0x6) != 0x6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+#endif
+}
+
+bool cpuHasAvx512()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 0xE6) != 0xE6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 16)) != 0;
+#else
+	return __builtin_cpu_supports("avx512f");
+#endif
+}
+
+#endif // SIMILARITY_X86
+
+#ifdef SIMILARITY_NEON
+
+float dotNeon(const float *a, const float *b, std::size_t n)
+{
+	float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+		acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+	}
+	float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+	for (; i < n; ++i)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+void dotBatchNeon(const float *query, const float *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	std::size_t r = 0;
+	for (; r + 4 <= count; r += 4) {
+		const float *r0 = rows + r * stride;
+		const float *r1 = r0 + stride;
+		const float *r2 = r1 + stride;
+		const float *r3 = r2 + stride;
+		float32x4_t a0 = vdupq_n_f32(0.0f), a1 = vdupq_n_f32(0.0f), a2 = vdupq_n_f32(0.0f), a3 = vdupq_n_f32(0.0f);
+		for (std::size_t i = 0; i < stride; i += 4) {
+			const float32x4_t q = vld1q_f32(query + i);
+			a0 = vfmaq_f32(a0, q, vld1q_f32(r0 + i));
+			a1 = vfmaq_f32(a1, q, vld1q_f32(r1 + i));
+			a2 = vfmaq_f32(a2, q, vld1q_f32(r2 + i));
+			a3 = vfmaq_f32(a3, q, vld1q_f32(r3 + i));
+		}
+		scores[r] = vaddvq_f32(a0);
+		scores[r + 1] = vaddvq_f32(a1);
+		scores[r + 2] = vaddvq_f32(a2);
+		scores[r + 3] = vaddvq_f32(a3);
+	}
+	for (; r < count; ++r)
+		scores[r] = dotNeon(query, rows + r * stride, stride);
+}
+
+void dotBatchF16Neon(const float *query, const std::uint16_t *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	for (std::size_t r = 0; r < count; ++r) {
+		const std::uint16_t *row = rows + r * stride;
+		float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+		for (std::size_t i = 0; i < stride; i += 8) {
+			const float16x8_t h = vreinterpretq_f16_u16(vld1q_u16(row + i));
+			acc0 = vfmaq_f32(acc0, vld1q_f32(query + i), vcvt_f32_f16(vget_low_f16(h)));
+			acc1 = vfmaq_f32(acc1, vld1q_f32(query + i + 4), vcvt_f32_f16(vget_high_f16(h)));
+		}
+		scores[r] = vaddvq_f32(vaddq_f32(acc0, acc1));
+	}
+}
+
+void dotBatchI8Neon(const float *query, const std::int8_t *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	for (std::size_t r = 0; r < count; ++r) {
+		const std::int8_t *row = rows + r * stride;
+		float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+		for (std::size_t i = 0; i < stride; i += 8) {
+			const int16x8_t wide = vmovl_s8(vld1_s8(row + i));
+			acc0 = vfmaq_f32(acc0, vld1q_f32(query + i), vcvtq_f32_s32(vmovl_s16(vget_low_s16(wide))));
+			acc1 = vfmaq_f32(acc1, vld1q_f32(query + i + 4), vcvtq_f32_s32(vmovl_s16(vget_high_s16(wide))));
+		}
+		scores[r] = vaddvq_f32(vaddq_f32(acc0, acc1));
+	}
+}
+
+#endif // SIMILARITY_NEON
+
+Kernels detectKernels()
+{
+#if defined(SIMILARITY_X86)
+	// every AVX2 capable CPU also has popcnt
+	if (cpuHasAvx512())
+		return { "avx512", dotAvx512, dotBatchAvx512, dotBatchF16Avx512, dotBatchI8Avx512, hammingBatchPopcnt };
+	if (cpuHasAvx2())
+		return { "avx2", dotAvx2, dotBatchAvx2, dotBatchF16Avx2, dotBatchI8Avx2, hammingBatchPopcnt };
+	return { "sse", dotSse, dotBatchSse, dotBatchF16Scalar, dotBatchI8Scalar, hammingBatchScalar };
+#elif defined(SIMILARITY_NEON)
+	return { "neon", dotNeon, dotBatchNeon, dotBatchF16Neon, dotBatchI8Neon, hammingBatchScalar };
+#else
+	return { "scalar", dotScalar, dotBatchScalar, dotBatchF16Scalar, dotBatchI8Scalar, hammingBatchScalar };
+#endif
+}
+
+const Kernels &kernels()
+{
+	static const Kernels selected = detectKernels();
+	return selected;
+}
+
+} // namespace
+
+float Similarity::dot(const float *a, const float *b, std::size_t dimension)
+{
+	return kernels().dot(a, b, dimension);
+}
+
+void Similarity::dotBatch(const float *query, const float *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	kernels().dotBatch(query, rows, stride, count, scores);
+}
+
+void Similarity::dotBatchF16(const float *query, const std::uint16_t *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	kernels().dotBatchF16(query, rows, stride, count, scores);
+}
+
+void Similarity::dotBatchI8(const float *query, const std::int8_t *rows, std::size_t stride, std::size_t count, float *scores)
+{
+	kernels().dotBatchI8(query, rows, stride, count, scores);
+}
+
+void Similarity::hammingBatch(const std::uint64_t *query, const std::uint64_t *codes, std::size_t words, std::size_t count, std::uint32_t *distances)
+{
+	kernels().hammingBatch(query, codes, words, count, distances);
+}
+
+std::uint16_t Similarity::toHalf(float value)
+{
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	const std::uint32_t sign = bits & 0x80000000u;
+	bits ^= sign;
+
+	std::uint16_t half;
+	if (bits >= 0x47800000u) {
+		// overflow to infinity, keep NaN a NaN
+		half = bits > 0x7f800000u ? 0x7e00 : 0x7c00;
+	} else if (bits < 0x38800000u) {
+		// subnormal or zero: let the FPU round the mantissa into place
+		const std::uint32_t magicBits = 126u << 23;
+		float magic, shifted;
+		std::memcpy(&magic, &magicBits, sizeof(magic));
+		std::memcpy(&shifted, &bits, sizeof(shifted));
+		shifted += magic;
+		std::memcpy(&bits, &shifted, sizeof(bits));
+		half = std::uint16_t(bits - magicBits);
+	} else {
+		const std::uint32_t odd = (bits >> 13) & 1u;
+		bits += (std::uint32_t(15 - 127) << 23) + 0xfffu + odd;
+		half = std::uint16_t(bits >> 13);
+	}
+	return std::uint16_t((sign >> 16) | half);
+}
+
+float Similarity::fromHalf(std::uint16_t value)
+{
+	constexpr std::uint32_t exponentMask = 0x7c00u << 13;
+	std::uint32_t bits = std::uint32_t(value & 0x7fffu) << 13;
+	const std::uint32_t exponent = bits & exponentMask;
+	bits += std::uint32_t(127 - 15) << 23;
+
+	float result;
+	if (exponent == exponentMask) {
+		bits += std::uint32_t(128 - 16) << 23; // infinity or NaN
+	} else if (exponent == 0) {
+		// subnormal: renormalize through the FPU
+		const std::uint32_t magicBits = 113u << 23;
+		float magic;
+		std::memcpy(&magic, &magicBits, sizeof(magic));
+		bits += 1u << 23;
+		std::memcpy(&result, &bits, sizeof(result));
+		result -= magic;
+		std::memcpy(&bits, &result, sizeof(bits));
+	}
+	bits |= std::uint32_t(value & 0x8000u) << 16;
+	std::memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+float Similarity::normalize(float *vector, std::size_t dimension)
+{
+	const float norm = std::sqrt(dot(vector, vector, dimension));
+	if (norm > 0.0f) {
+		const float scale = 1.0f / norm;
+		for (std::size_t i = 0; i < dimension; ++i)
+			vector[i] *= scale;
+	}
+	return norm;
+}
+
+const char *Similarity::kernelName()
+{
+	return kernels().name;
+}
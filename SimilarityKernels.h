@@ -0,0 +1,67 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SIMILARITYKERNELS_H
+#define SIMILARITYKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Similarity kernels with runtime CPU dispatch (AVX-512, AVX2/FMA, SSE or
+// NEON, scalar fallback). Stored embeddings are normalized once, so cosine
+// similarity reduces to a dot product. Rows may be float32, float16 or int8;
+// quantized rows are widened in registers, never expanded in memory.
+namespace Similarity
+{
+
+// Dot product of two vectors of arbitrary dimension.
+float dot(const float *a, const float *b, std::size_t dimension);
+
+// Scores `count` rows laid out `stride` floats apart against `query`.
+// `stride` must be a multiple of 16 and both the query and every row must be
+// zero padded up to `stride`, which lets the kernels run without tail loops.
+void dotBatch(const float *query, const float *rows, std::size_t stride, std::size_t count, float *scores);
+
+// Same as dotBatch() for IEEE half precision rows.
+void dotBatchF16(const float *query, const std::uint16_t *rows, std::size_t stride, std::size_t count, float *scores);
+
+// Same as dotBatch() for int8 rows; the caller applies the per-row scale.
+void dotBatchI8(const float *query, const std::int8_t *rows, std::size_t stride, std::size_t count, float *scores);
+
+// Hamming distances between a binary code and `count` codes of `words`
+// 64-bit words each.
+void hammingBatch(const std::uint64_t *query, const std::uint64_t *codes, std::size_t words, std::size_t count, std::uint32_t *distances);
+
+// Scalar IEEE half conversion with round to nearest even.
+std::uint16_t toHalf(float value);
+float fromHalf(std::uint16_t value);
+
+// Scales `vector` to unit length in place and returns its original norm.
+float normalize(float *vector, std::size_t dimension);
+
+// Name of the kernel selected for this CPU, e.g. "avx2".
+const char *kernelName();
+
+} // namespace Similarity
+
+#endif // SIMILARITYKERNELS_H
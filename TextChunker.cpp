@@ -0,0 +1,184 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "TextChunker.h"
+
+// Word pieces of about four characters each, like BPE vocabularies produce
+static inline qsizetype wordTokens(qsizetype length)
+{
+	return (length + 3) / 4;
+}
+
+TextChunker::TextChunker(const Options &options)
+	: m_options(options)
+{
+	m_options.size = qMax(1, m_options.size);
+	m_options.overlap = qBound(0, m_options.overlap, m_options.size - 1);
+}
+
+void TextChunker::split(QStringView text, const Sink &sink) const
+{
+	const qsizetype n = text.size();
+	auto skipSpace = [text, n](qsizetype pos) {
+		while (pos < n && text[pos].isSpace())
+			++pos;
+		return pos;
+	};
+
+	qsizetype begin = skipSpace(0);
+	while (begin < n) {
+		// a sentence or paragraph may run on by half a chunk to end cleanly
+		const qsizetype sized = advance(text, begin, m_options.size);
+		const qsizetype end = sized < n ? boundaryAfter(text, sized, sized + (sized - begin) / 2) : n;
+		const qsizetype next = skipSpace(end);
+
+		qsizetype trimmed = end;
+		while (trimmed > begin && text[trimmed - 1].isSpace())
+			--trimmed;
+		if (next >= n) {
+			sink(begin, trimmed, true);
+			return;
+		}
+		if (!sink(begin, trimmed, false))
+			return;
+
+		// The next chunk starts `overlap` units before this one ended, at the
+		// start of a whitespace separated word
+		qsizetype start = retreat(text, end, m_options.overlap);
+		while (start - 1 > begin && !text[start - 1].isSpace())
+			--start;
+		start = skipSpace(start);
+		begin = start > begin && start < end ? start : next;
+	}
+	sink(n, n, true);
+}
+
+qsizetype TextChunker::advance(QStringView text, qsizetype pos, int units) const
+{
+	const qsizetype n = text.size();
+	if (m_options.unit == Unit::Characters)
+		return qMin(n, pos + units);
+
+	qsizetype count = 0;
+	while (pos < n && count < units) {
+		const QChar c = text[pos];
+		if (c.isLetterOrNumber()) {
+			qsizetype end = pos + 1;
+			while (end < n && text[end].isLetterOrNumber())
+				++end;
+			count += wordTokens(end - pos);
+			pos = end;
+		} else {
+			if (!c.isSpace())
+				++count; // punctuation is a token of its own
+			++pos;
+		}
+	}
+	return pos;
+}
+
+qsizetype TextChunker::retreat(QStringView text, qsizetype pos, int units) const
+{
+	if (m_options.unit == Unit::Characters)
+		return qMax<qsizetype>(0, pos - units);
+
+	qsizetype count = 0;
+	while (pos > 0 && count < units) {
+		const QChar c = text[pos - 1];
+		if (c.isLetterOrNumber()) {
+			qsizetype begin = pos - 1;
+			while (begin > 0 && text[begin - 1].isLetterOrNumber())
+				--begin;
+			count += wordTokens(pos - begin);
+			pos = begin;
+		} else {
+			if (!c.isSpace())
+				++count;
+			--pos;
+		}
+	}
+	return pos;
+}
+
+qsizetype TextChunker::boundaryAfter(QStringView text, qsizetype pos, qsizetype limit) const
+{
+	const qsizetype n = text.size();
+	limit = qMin(limit, n);
+
+	if (m_options.boundary == Boundary::Paragraph) {
+		for (qsizetype i = pos; i + 1 < limit; ++i) {
+			if (text[i] == u'\n' && text[i + 1] == u'\n')
+				return i;
+		}
+	}
+	if (m_options.boundary != Boundary::Word) {
+		for (qsizetype i = pos; i < limit; ++i) {
+			const QChar c = text[i];
+			if ((c == u'.' || c == u'!' || c == u'?') && (i + 1 == n || text[i + 1].isSpace()))
+				return i + 1;
+		}
+	}
+
+	// Split at whitespace and therefore avoid cutting words in half
+	while (pos < n && !text[pos].isSpace())
+		++pos;
+	return pos;
+}
+
+int TextChunker::estimateTokens(QStringView text)
+{
+	const qsizetype n = text.size();
+	qsizetype count = 0;
+	for (qsizetype pos = 0; pos < n;) {
+		if (text[pos].isLetterOrNumber()) {
+			const qsizetype begin = pos;
+			while (pos < n && text[pos].isLetterOrNumber())
+				++pos;
+			count += wordTokens(pos - begin);
+		} else {
+			if (!text[pos].isSpace())
+				++count;
+			++pos;
+		}
+	}
+	return int(count);
+}
+
+QString TextChunker::cleanPage(QStringView page)
+{
+	QString text;
+	text.reserve(page.size());
+	for (qsizetype i = 0; i < page.size(); ++i) {
+		const QChar c = page[i];
+		if (c.unicode() == 0xFFFE)
+			continue;
+		if (c == u'\r' && i + 1 < page.size() && page[i + 1] == u'\n')
+			continue;
+		if (c == u'\n') {
+			while (text.endsWith(u' '))
+				text.chop(1);
+		}
+		text.append(c);
+	}
+	return text;
+}
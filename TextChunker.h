@@ -0,0 +1,79 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TEXTCHUNKER_H
+#define TEXTCHUNKER_H
+
+#include <QString>
+#include <QStringView>
+
+#include <functional>
+
+// Splits text into overlapping chunks in one pass over a view of it. Chunks
+// are reported as offsets, so the text itself is never copied or shifted;
+// sizes are counted in characters or in estimated model tokens and chunks
+// end on a word, sentence or paragraph boundary.
+class TextChunker
+{
+public:
+	enum class Unit {
+		Characters,
+		Tokens // estimated, about four characters of a word per token
+	};
+
+	enum class Boundary {
+		Word,
+		Sentence, // falls back to a word boundary
+		Paragraph // falls back to a sentence, then a word boundary
+	};
+
+	struct Options {
+		int size = 200;
+		int overlap = 20;
+		Unit unit = Unit::Tokens;
+		Boundary boundary = Boundary::Sentence;
+	};
+
+	// Receives [begin, end) of each chunk, `last` is set on exactly one call
+	// (an empty range for blank text). Returning false stops the split.
+	using Sink = std::function<bool(qsizetype begin, qsizetype end, bool last)>;
+
+	TextChunker() = default;
+	explicit TextChunker(const Options &options);
+
+	void split(QStringView text, const Sink &sink) const;
+
+	// Drops U+FFFE, converts CRLF and removes spaces before line breaks
+	static QString cleanPage(QStringView page);
+	// Tokens as counted for Unit::Tokens
+	static int estimateTokens(QStringView text);
+
+private:
+	qsizetype advance(QStringView text, qsizetype pos, int units) const;
+	qsizetype retreat(QStringView text, qsizetype pos, int units) const;
+	qsizetype boundaryAfter(QStringView text, qsizetype pos, qsizetype limit) const;
+
+	Options m_options;
+};
+
+#endif // TEXTCHUNKER_H
@@ -0,0 +1,84 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <QVector>
+
+#include <algorithm>
+
+struct ScoredId {
+	float score;
+	int seqId;
+};
+
+// Bounded selection of the k best scores. A min-heap holds the current
+// winners so each candidate costs one comparison against the weakest of them
+// and the full score list is never materialized.
+class TopK
+{
+public:
+	explicit TopK(int k) : m_k(qMax(k, 0)) { m_heap.reserve(m_k); }
+
+	inline bool accepts(float score) const {
+		// nothing is accepted for k = 0, the heap stays empty
+		return m_heap.size() < m_k || (m_k > 0 && score > m_heap.front().score);
+	}
+
+	inline void push(float score, int seqId) {
+		if (m_heap.size() < m_k) {
+			m_heap.append({score, seqId});
+			std::push_heap(m_heap.begin(), m_heap.end(), worse);
+		} else if (m_k > 0 && score > m_heap.front().score) {
+			std::pop_heap(m_heap.begin(), m_heap.end(), worse);
+			m_heap.last() = {score, seqId};
+			std::push_heap(m_heap.begin(), m_heap.end(), worse);
+		}
+	}
+
+	inline void merge(const TopK &other) {
+		for (const ScoredId &entry : other.m_heap)
+			push(entry.score, entry.seqId);
+	}
+
+	inline int k() const { return m_k; }
+	inline qsizetype size() const { return m_heap.size(); }
+
+	// Winners ordered from best to worst
+	QVector<ScoredId> sorted() const {
+		QVector<ScoredId> result = m_heap;
+		std::sort(result.begin(), result.end(), [](const ScoredId &a, const ScoredId &b) {
+			return a.score > b.score;
+		});
+		return result;
+	}
+
+private:
+	static inline bool worse(const ScoredId &a, const ScoredId &b) { return a.score > b.score; }
+
+	qsizetype m_k;
+	QVector<ScoredId> m_heap;
+};
+
+#endif // TOPK_H
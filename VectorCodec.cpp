@@ -0,0 +1,142 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "VectorCodec.h"
+#include "SimilarityKernels.h"
+
+#include <cmath>
+#include <cstring>
+
+QString VectorCodec::name(VectorEncoding encoding)
+{
+	switch (encoding) {
+	case VectorEncoding::Float64: return "f64";
+	case VectorEncoding::Float32: return "f32";
+	case VectorEncoding::Float16: return "f16";
+	case VectorEncoding::Int8: return "int8";
+	}
+	return {};
+}
+
+std::optional<VectorEncoding> VectorCodec::fromName(const QString &name)
+{
+	if (name.isEmpty() || name == "f64")
+		return VectorEncoding::Float64;
+	if (name == "f32")
+		return VectorEncoding::Float32;
+	if (name == "f16")
+		return VectorEncoding::Float16;
+	if (name == "int8")
+		return VectorEncoding::Int8;
+	return {};
+}
+
+QByteArray VectorCodec::encode(const QVector<double> &vector, VectorEncoding encoding)
+{
+	const int dimension = int(vector.size());
+	QByteArray data;
+
+	switch (encoding) {
+	case VectorEncoding::Float64:
+		data.resize(dimension * sizeof(double));
+		std::memcpy(data.data(), vector.constData(), data.size());
+		break;
+	case VectorEncoding::Float32: {
+		data.resize(dimension * sizeof(float));
+		float *out = reinterpret_cast<float*>(data.data());
+		for (int i = 0; i < dimension; ++i)
+			out[i] = float(vector[i]);
+		break;
+	}
+	case VectorEncoding::Float16: {
+		data.resize(dimension * sizeof(std::uint16_t));
+		std::uint16_t *out = reinterpret_cast<std::uint16_t*>(data.data());
+		for (int i = 0; i < dimension; ++i)
+			out[i] = Similarity::toHalf(float(vector[i]));
+		break;
+	}
+	case VectorEncoding::Int8: {
+		const QVector<float> values(vector.begin(), vector.end());
+		data.resize(sizeof(float) + dimension);
+		const float scale = quantize(values.constData(), dimension, reinterpret_cast<std::int8_t*>(data.data() + sizeof(float)));
+		std::memcpy(data.data(), &scale, sizeof(float));
+		break;
+	}
+	}
+	return data;
+}
+
+bool VectorCodec::decode(const QByteArray &data, VectorEncoding encoding, QVector<float> &vector)
+{
+	switch (encoding) {
+	case VectorEncoding::Float64: {
+		if (data.size() % sizeof(double) != 0)
+			return false;
+		const double *in = reinterpret_cast<const double*>(data.constData());
+		vector.resize(data.size() / sizeof(double));
+		for (qsizetype i = 0; i < vector.size(); ++i)
+			vector[i] = float(in[i]);
+		return true;
+	}
+	case VectorEncoding::Float32:
+		if (data.size() % sizeof(float) != 0)
+			return false;
+		vector.resize(data.size() / sizeof(float));
+		std::memcpy(vector.data(), data.constData(), data.size());
+		return true;
+	case VectorEncoding::Float16: {
+		if (data.size() % sizeof(std::uint16_t) != 0)
+			return false;
+		const std::uint16_t *in = reinterpret_cast<const std::uint16_t*>(data.constData());
+		vector.resize(data.size() / sizeof(std::uint16_t));
+		for (qsizetype i = 0; i < vector.size(); ++i)
+			vector[i] = Similarity::fromHalf(in[i]);
+		return true;
+	}
+	case VectorEncoding::Int8: {
+		if (data.size() < qsizetype(sizeof(float)))
+			return false;
+		float scale;
+		std::memcpy(&scale, data.constData(), sizeof(float));
+		const std::int8_t *in = reinterpret_cast<const std::int8_t*>(data.constData() + sizeof(float));
+		vector.resize(data.size() - sizeof(float));
+		for (qsizetype i = 0; i < vector.size(); ++i)
+			vector[i] = float(in[i]) * scale;
+		return true;
+	}
+	}
+	return false;
+}
+
+float VectorCodec::quantize(const float *vector, int dimension, std::int8_t *quantized)
+{
+	float maximum = 0.0f;
+	for (int i = 0; i < dimension; ++i)
+		maximum = qMax(maximum, std::abs(vector[i]));
+
+	const float scale = maximum > 0.0f ? maximum / 127.0f : 1.0f;
+	const float inverse = 1.0f / scale;
+	for (int i = 0; i < dimension; ++i)
+		quantized[i] = std::int8_t(qBound(-127l, std::lround(vector[i] * inverse), 127l));
+	return scale;
+}
@@ -0,0 +1,57 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef VECTORCODEC_H
+#define VECTORCODEC_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include <cstdint>
+#include <optional>
+
+// Storage formats of the embeddings_queue.vector column, recorded per row in
+// the encoding column. Rows without an encoding are legacy raw doubles.
+enum class VectorEncoding {
+	Float64,
+	Float32,
+	Float16,
+	Int8     // float32 scale followed by one signed byte per dimension
+};
+
+namespace VectorCodec
+{
+
+QString name(VectorEncoding encoding);
+std::optional<VectorEncoding> fromName(const QString &name);
+
+QByteArray encode(const QVector<double> &vector, VectorEncoding encoding);
+bool decode(const QByteArray &data, VectorEncoding encoding, QVector<float> &vector);
+
+// Symmetric int8 quantization, returns the scale so that x ~ q * scale
+float quantize(const float *vector, int dimension, std::int8_t *quantized);
+
+} // namespace VectorCodec
+
+#endif // VECTORCODEC_H
@@ -0,0 +1,336 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "VectorStore.h"
+#include "SimilarityKernels.h"
+
+#include <QFile>
+#include <QSaveFile>
+
+#include <cstring>
+#include <new>
+
+namespace
+{
+
+constexpr quint32 VectorFileMagic = 0x53565251; // "QRVS"
+constexpr quint32 VectorFileVersion = 1;
+// the vector region starts on its own page so the mapped rows stay aligned
+constexpr qint64 PageSize = 4096;
+
+struct VectorFileHeader {
+	quint32 magic;
+	quint32 version;
+	qint32 encoding;
+	qint32 dimension;
+	qint32 stride;
+	qint32 reserved;
+	qint64 rows;
+	qint64 rowBytes;
+	qint64 dataOffset; // rows * rowBytes bytes of vector data
+	qint64 metaOffset; // seq ids, norms and (int8 only) scales
+};
+
+inline int elementSize(VectorEncoding encoding)
+{
+	switch (encoding) {
+	case VectorEncoding::Float16: return 2;
+	case VectorEncoding::Int8: return 1;
+	default: return 4;
+	}
+}
+
+} // namespace
+
+VectorStore::~VectorStore()
+{
+	clear();
+}
+
+void VectorStore::reset(int dimension, VectorEncoding encoding)
+{
+	clear();
+	// doubles are only a storage format, in memory they become float32
+	m_encoding = encoding == VectorEncoding::Float64 ? VectorEncoding::Float32 : encoding;
+	m_dimension = dimension;
+	// pad every row to a full cache line so each row starts aligned
+	const int perLine = Alignment / elementSize(m_encoding);
+	m_stride = (dimension + perLine - 1) / perLine * perLine;
+	m_rowBytes = qsizetype(m_stride) * elementSize(m_encoding);
+}
+
+void VectorStore::clear()
+{
+	if (m_file)
+		m_file.reset(); // unmaps the matrix
+	else if (m_data)
+		::operator delete(m_data, std::align_val_t(Alignment));
+	m_data = nullptr;
+	m_rows = 0;
+	m_capacity = 0;
+	m_scales.clear();
+	m_norms.clear();
+	m_seqIds.clear();
+	m_ids.clear();
+	m_rowBySeqId.clear();
+}
+
+void VectorStore::reserve(qsizetype rows)
+{
+	if (rows > m_capacity)
+		grow(rows);
+	if (m_encoding == VectorEncoding::Int8)
+		m_scales.reserve(rows);
+	m_norms.reserve(rows);
+	m_seqIds.reserve(rows);
+	m_ids.reserve(rows);
+	m_rowBySeqId.reserve(rows);
+}
+
+void VectorStore::append(int seqId, const QString &id, const float *vector)
+{
+	Q_ASSERT(m_dimension > 0);
+	detach();
+	if (m_rows == m_capacity)
+		grow(qMax<qsizetype>(1024, m_capacity * 2));
+
+	QVector<float> normalized(vector, vector + m_dimension);
+	m_norms.append(Similarity::normalize(normalized.data(), m_dimension));
+
+	char *dst = m_data + m_rows * m_rowBytes;
+	std::memset(dst, 0, m_rowBytes);
+	switch (m_encoding) {
+	case VectorEncoding::Float16: {
+		std::uint16_t *out = reinterpret_cast<std::uint16_t*>(dst);
+		for (int i = 0; i < m_dimension; ++i)
+			out[i] = Similarity::toHalf(normalized[i]);
+		break;
+	}
+	case VectorEncoding::Int8:
+		m_scales.append(VectorCodec::quantize(normalized.constData(), m_dimension, reinterpret_cast<std::int8_t*>(dst)));
+		break;
+	default:
+		std::memcpy(dst, normalized.constData(), m_dimension * sizeof(float));
+		break;
+	}
+
+	m_seqIds.append(seqId);
+	m_ids.append(id);
+	m_rowBySeqId.insert(seqId, m_rows);
+	++m_rows;
+}
+
+bool VectorStore::remove(int seqId)
+{
+	auto it = m_rowBySeqId.find(seqId);
+	if (it == m_rowBySeqId.end())
+		return false;
+
+	detach();
+
+	// move the last row into the freed slot to keep the matrix dense
+	const qsizetype row = it.value();
+	const qsizetype last = m_rows - 1;
+	m_rowBySeqId.erase(it);
+	if (row != last) {
+		std::memcpy(m_data + row * m_rowBytes, m_data + last * m_rowBytes, m_rowBytes);
+		if (m_encoding == VectorEncoding::Int8)
+			m_scales[row] = m_scales[last];
+		m_norms[row] = m_norms[last];
+		m_seqIds[row] = m_seqIds[last];
+		m_ids[row] = m_ids[last];
+		m_rowBySeqId[m_seqIds[row]] = row;
+	}
+	if (m_encoding == VectorEncoding::Int8)
+		m_scales.removeLast();
+	m_norms.removeLast();
+	m_seqIds.removeLast();
+	m_ids.removeLast();
+	--m_rows;
+	return true;
+}
+
+void VectorStore::decode(qsizetype row, float *vector) const
+{
+	const char *src = rowData(row);
+	switch (m_encoding) {
+	case VectorEncoding::Float16: {
+		const std::uint16_t *in = reinterpret_cast<const std::uint16_t*>(src);
+		for (int i = 0; i < m_stride; ++i)
+			vector[i] = Similarity::fromHalf(in[i]);
+		break;
+	}
+	case VectorEncoding::Int8: {
+		const std::int8_t *in = reinterpret_cast<const std::int8_t*>(src);
+		for (int i = 0; i < m_stride; ++i)
+			vector[i] = float(in[i]) * m_scales[row];
+		break;
+	}
+	default:
+		std::memcpy(vector, src, m_stride * sizeof(float));
+		break;
+	}
+}
+
+float VectorStore::score(const float *query, qsizetype row) const
+{
+	float result;
+	scoreBatch(query, row, 1, &result);
+	return result;
+}
+
+void VectorStore::scoreBatch(const float *query, qsizetype begin, qsizetype count, float *scores) const
+{
+	switch (m_encoding) {
+	case VectorEncoding::Float16:
+		Similarity::dotBatchF16(query, reinterpret_cast<const std::uint16_t*>(rowData(begin)), m_stride, count, scores);
+		break;
+	case VectorEncoding::Int8:
+		Similarity::dotBatchI8(query, reinterpret_cast<const std::int8_t*>(rowData(begin)), m_stride, count, scores);
+		for (qsizetype i = 0; i < count; ++i)
+			scores[i] *= m_scales[begin + i];
+		break;
+	default:
+		Similarity::dotBatch(query, reinterpret_cast<const float*>(rowData(begin)), m_stride, count, scores);
+		break;
+	}
+}
+
+qsizetype VectorStore::rowOf(int seqId) const
+{
+	return m_rowBySeqId.value(seqId, -1);
+}
+
+void VectorStore::grow(qsizetype capacity)
+{
+	char *data = static_cast<char*>(::operator new(capacity * m_rowBytes, std::align_val_t(Alignment)));
+	if (m_data) {
+		std::memcpy(data, m_data, m_rows * m_rowBytes);
+		if (m_file)
+			m_file.reset();
+		else
+			::operator delete(m_data, std::align_val_t(Alignment));
+	}
+	m_data = data;
+	m_capacity = capacity;
+}
+
+void VectorStore::detach()
+{
+	if (m_file)
+		grow(qMax<qsizetype>(1024, m_rows));
+}
+
+bool VectorStore::save(const QString &fileName) const
+{
+	QSaveFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+
+	VectorFileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.magic = VectorFileMagic;
+	header.version = VectorFileVersion;
+	header.encoding = qint32(m_encoding);
+	header.dimension = m_dimension;
+	header.stride = m_stride;
+	header.rows = m_rows;
+	header.rowBytes = m_rowBytes;
+	header.dataOffset = PageSize;
+	header.metaOffset = PageSize + m_rows * m_rowBytes;
+
+	auto write = [&file](const void *data, qint64 size) {
+		return file.write(static_cast<const char*>(data), size) == size;
+	};
+
+	const QByteArray padding(PageSize - qint64(sizeof(header)), '\0');
+	bool ok = write(&header, sizeof(header))
+			&& write(padding.constData(), padding.size())
+			&& write(m_data, m_rows * m_rowBytes)
+			&& write(m_seqIds.constData(), m_rows * sizeof(int))
+			&& write(m_norms.constData(), m_rows * sizeof(float));
+	if (ok && m_encoding == VectorEncoding::Int8)
+		ok = write(m_scales.constData(), m_rows * sizeof(float));
+
+	return ok && file.commit();
+}
+
+bool VectorStore::map(const QString &fileName)
+{
+	clear();
+
+	auto file = std::make_unique<QFile>(fileName);
+	if (!file->open(QIODevice::ReadOnly))
+		return false;
+
+	VectorFileHeader header;
+	if (file->read(reinterpret_cast<char*>(&header), sizeof(header)) != qint64(sizeof(header))
+			|| header.magic != VectorFileMagic || header.version != VectorFileVersion
+			|| header.dimension <= 0 || header.rows < 0)
+		return false;
+
+	const VectorEncoding encoding = VectorEncoding(header.encoding);
+	if (encoding != VectorEncoding::Float32 && encoding != VectorEncoding::Float16 && encoding != VectorEncoding::Int8)
+		return false;
+
+	reset(header.dimension, encoding);
+	const qint64 rows = header.rows;
+	const qint64 metaBytes = rows * qint64(sizeof(int) + sizeof(float) + (encoding == VectorEncoding::Int8 ? sizeof(float) : 0));
+	if (header.stride != m_stride || header.rowBytes != m_rowBytes || header.dataOffset % PageSize != 0
+			|| header.metaOffset != header.dataOffset + rows * m_rowBytes
+			|| file->size() < header.metaOffset + metaBytes)
+		return false;
+
+	uchar *base = file->map(0, file->size());
+	if (!base)
+		return false;
+
+	// the per-row arrays are small, only the matrix stays in the mapping
+	const uchar *meta = base + header.metaOffset;
+	m_seqIds.resize(rows);
+	std::memcpy(m_seqIds.data(), meta, rows * sizeof(int));
+	meta += rows * sizeof(int);
+	m_norms.resize(rows);
+	std::memcpy(m_norms.data(), meta, rows * sizeof(float));
+	meta += rows * sizeof(float);
+	if (encoding == VectorEncoding::Int8) {
+		m_scales.resize(rows);
+		std::memcpy(m_scales.data(), meta, rows * sizeof(float));
+	}
+	m_ids.resize(rows);
+	m_rowBySeqId.reserve(rows);
+	for (qsizetype row = 0; row < rows; ++row)
+		m_rowBySeqId.insert(m_seqIds[row], row);
+
+	m_data = reinterpret_cast<char*>(base + header.dataOffset);
+	m_rows = rows;
+	m_capacity = rows;
+	m_file = std::move(file);
+
+	if (m_rowBySeqId.size() != m_rows) {
+		// duplicate seq ids, the file is corrupt
+		clear();
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,107 @@
+/* MIT License
+ *
+ * Copyright (c) 2024 CURTLab, Fabian Hauser
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef VECTORSTORE_H
+#define VECTORSTORE_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+
+#include <memory>
+
+#include "VectorCodec.h"
+
+class QFile;
+
+// Resident structure-of-arrays copy of all embeddings. Vectors are kept as one
+// contiguous row-major matrix (rows padded to a cache line) with parallel
+// id/seq_id arrays, so a query is a single linear pass over memory. Rows are
+// normalized on insert and their original norm is kept alongside. The matrix
+// holds float32, float16 or int8 (with a per-row scale) elements and is
+// scored in that format.
+//
+// The matrix can also be saved to and memory mapped from a sidecar file, in
+// which case queries run directly on the read-only mapping. The first change
+// to a mapped store copies the matrix to the heap.
+class VectorStore
+{
+public:
+	static constexpr int Alignment = 64;
+
+	VectorStore() = default;
+	~VectorStore();
+
+	VectorStore(const VectorStore&) = delete;
+	VectorStore& operator=(const VectorStore&) = delete;
+
+	void reset(int dimension, VectorEncoding encoding = VectorEncoding::Float32);
+	void clear();
+	void reserve(qsizetype rows);
+
+	void append(int seqId, const QString &id, const float *vector);
+	bool remove(int seqId);
+
+	bool save(const QString &fileName) const;
+	// Maps a file written by save(), ids are not stored and must be set
+	bool map(const QString &fileName);
+	inline bool isMapped() const { return m_file != nullptr; }
+	inline void setId(qsizetype row, const QString &id) { m_ids[row] = id; }
+
+	inline VectorEncoding encoding() const { return m_encoding; }
+	inline int dimension() const { return m_dimension; }
+	// elements per row, a multiple of 16; queries must be zero padded to it
+	inline int stride() const { return m_stride; }
+	inline qsizetype size() const { return m_rows; }
+	inline bool isEmpty() const { return m_rows == 0; }
+
+	inline const char *rowData(qsizetype row) const { return m_data + row * m_rowBytes; }
+	void decode(qsizetype row, float *vector) const;
+	float score(const float *query, qsizetype row) const;
+	void scoreBatch(const float *query, qsizetype begin, qsizetype count, float *scores) const;
+
+	inline float norm(qsizetype row) const { return m_norms[row]; }
+	inline int seqId(qsizetype row) const { return m_seqIds[row]; }
+	inline const QString &id(qsizetype row) const { return m_ids[row]; }
+	qsizetype rowOf(int seqId) const;
+
+private:
+	void grow(qsizetype capacity);
+	void detach();
+
+	char *m_data = nullptr;
+	qsizetype m_rows = 0;
+	qsizetype m_capacity = 0;
+	qsizetype m_rowBytes = 0;
+	int m_dimension = 0;
+	int m_stride = 0;
+	VectorEncoding m_encoding = VectorEncoding::Float32;
+	QVector<float> m_scales;
+	QVector<float> m_norms;
+	QVector<int> m_seqIds;
+	QVector<QString> m_ids;
+	QHash<int, qsizetype> m_rowBySeqId;
+	std::unique_ptr<QFile> m_file;
+};
+
+#endif // VECTORSTORE_H